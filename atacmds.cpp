@@ -48,6 +48,18 @@ bool dont_print_serial_number = false;
 #define SRET_STATUS_MID_EXCEEDED 0xF4
 
 
+const ata_vendor_attr_defs::entry ata_vendor_attr_defs::s_default_entry;
+
+// Return table for modification, copy if shared.
+ata_vendor_attr_defs::table * ata_vendor_attr_defs::get_writable()
+{
+  if (!m_table)
+    m_table = std::make_shared<table>();
+  else if (m_table.use_count() > 1)
+    m_table = std::make_shared<table>(*m_table);
+  return m_table.get();
+}
+
 // Get ID and increase flag of current pending or offline
 // uncorrectable attribute.
 unsigned char get_unc_attr_id(bool offline, const ata_vendor_attr_defs & defs,
@@ -1076,10 +1088,51 @@ bool ataReadExtSelfTestLog(ata_device * device, ata_smart_extselftestlog * log,
   return true;
 }
 
+ata_log_cache::ata_log_cache(ata_device * device)
+: m_device(device)
+{
+  if (m_device)
+    m_device->set_log_cache(this);
+}
+
+ata_log_cache::~ata_log_cache()
+{
+  if (m_device && m_device->get_log_cache() == this)
+    m_device->set_log_cache(nullptr);
+}
+
+bool ata_log_cache::get(unsigned char logaddr, unsigned page, void * data,
+                        unsigned nsectors) const
+{
+  for (unsigned i = 0; i < nsectors; i++) {
+    auto it = m_sectors.find((unsigned)logaddr << 16 | ((page + i) & 0xffff));
+    if (it == m_sectors.end())
+      return false;
+  }
+  for (unsigned i = 0; i < nsectors; i++) {
+    auto it = m_sectors.find((unsigned)logaddr << 16 | ((page + i) & 0xffff));
+    memcpy((char *)data + 512*i, it->second.data(), 512);
+  }
+  return true;
+}
+
+void ata_log_cache::add(unsigned char logaddr, unsigned page, const void * data,
+                        unsigned nsectors)
+{
+  for (unsigned i = 0; i < nsectors; i++) {
+    const unsigned char * p = (const unsigned char *)data + 512*i;
+    m_sectors[(unsigned)logaddr << 16 | ((page + i) & 0xffff)].assign(p, p + 512);
+  }
+}
+
 // Write GP Log page(s)
 bool ataWriteLogExt(ata_device * device, unsigned char logaddr,
                     unsigned page, void * data, unsigned nsectors)
 {
+  // Log contents may change
+  if (device->get_log_cache())
+    device->get_log_cache()->clear();
+
   ata_cmd_in in;
   in.in_regs.command      = ATA_WRITE_LOG_EXT;
   in.set_data_out(data, nsectors);
@@ -1112,30 +1165,41 @@ bool ataReadLogExt(ata_device * device, unsigned char logaddr,
                    unsigned char features, unsigned page,
                    void * data, unsigned nsectors)
 {
-  ata_cmd_in in;
-  in.in_regs.command      = ATA_READ_LOG_EXT;
-  in.in_regs.features     = features; // log specific
-  in.set_data_in_48bit(data, nsectors);
-  in.in_regs.lba_low      = logaddr;
-  in.in_regs.lba_mid_16   = page;
+  // Use sectors prefetched by the caller
+  const ata_log_cache * cache = device->get_log_cache();
+  if (!features && cache && cache->get(logaddr, page, data, nsectors))
+    return true;
+
+  // Skip multi-sector read if it failed before
+  if (nsectors <= 1 || !device->single_sector_log_ext()) {
+    ata_cmd_in in;
+    in.in_regs.command      = ATA_READ_LOG_EXT;
+    in.in_regs.features     = features; // log specific
+    in.set_data_in_48bit(data, nsectors);
+    in.in_regs.lba_low      = logaddr;
+    in.in_regs.lba_mid_16   = page;
+
+    if (device->ata_pass_through(in)) // TODO: Debug output
+      return true;
 
-  if (!device->ata_pass_through(in)) { // TODO: Debug output
     if (nsectors <= 1) {
       pout("ATA_READ_LOG_EXT (addr=0x%02x:0x%02x, page=%u, n=%u) failed: %s\n",
            logaddr, features, page, nsectors, device->get_errmsg());
       return false;
     }
+  }
 
-    // Recurse to retry with single sectors,
-    // multi-sector reads may not be supported by ioctl.
-    for (unsigned i = 0; i < nsectors; i++) {
-      if (!ataReadLogExt(device, logaddr,
-                         features, page + i,
-                         (char *)data + 512*i, 1))
-        return false;
-    }
+  // Recurse to retry with single sectors,
+  // multi-sector reads may not be supported by ioctl.
+  for (unsigned i = 0; i < nsectors; i++) {
+    if (!ataReadLogExt(device, logaddr,
+                       features, page + i,
+                       (char *)data + 512*i, 1))
+      return false;
   }
 
+  // Single sector reads worked, use these for further reads
+  device->set_single_sector_log_ext();
   return true;
 }
 
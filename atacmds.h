@@ -18,6 +18,10 @@
 #include "dev_interface.h" // ata_device
 #include "static_assert.h"
 
+#include <map>
+#include <memory>
+#include <vector>
+
 // Add __attribute__((packed)) if compiler supports it
 // because some gcc versions (at least ARM) lack support of #pragma pack()
 #ifdef HAVE_ATTR_PACKED
@@ -678,7 +682,11 @@ enum {
   ATTRFLAG_SSD_ONLY    = 0x10, // DEFAULT setting for SSD only
 };
 
-// Vendor attribute display defs for all attribute ids
+// Vendor attribute display defs for all attribute ids.
+// Copies share the table until one of them is modified, so defs
+// interned from the drive database are not duplicated for each device.
+// References returned by non-const operator[] are only valid until
+// the object is copied.
 class ata_vendor_attr_defs
 {
 public:
@@ -698,13 +706,24 @@ public:
   };
 
   entry & operator[](unsigned char id)
-    { return m_defs[id]; }
+    { return get_writable()->defs[id]; }
 
   const entry & operator[](unsigned char id) const
-    { return m_defs[id]; }
+    { return (m_table ? m_table->defs[id] : s_default_entry); }
+
+  /// Return true if no entry was modified.
+  bool empty() const
+    { return !m_table; }
 
 private:
-  entry m_defs[256];
+  struct table
+  {
+    entry defs[256];
+  };
+  std::shared_ptr<table> m_table; // nullptr if all entries are default
+  static const entry s_default_entry;
+
+  table * get_writable();
 };
 
 
@@ -766,6 +785,36 @@ int ataReadSelfTestLog(ata_device * device, ata_smart_selftestlog * data,
 int ataReadSelectiveSelfTestLog(ata_device * device, struct ata_selective_self_test_log *data);
 int ataReadLogDirectory(ata_device * device, ata_smart_log_directory *, bool gpl);
 
+// Cache of GP log sectors. While attached to a device, ataReadLogExt()
+// returns sectors added by the caller instead of reading them again.
+// ataWriteLogExt() clears the cache.
+class ata_log_cache
+{
+public:
+  // Attach to device if nonnull
+  explicit ata_log_cache(ata_device * device = nullptr);
+  // Detach from device
+  ~ata_log_cache();
+
+  // Copy cached sectors to data, return false if any is missing.
+  bool get(unsigned char logaddr, unsigned page, void * data,
+           unsigned nsectors) const;
+
+  // Add sectors.
+  void add(unsigned char logaddr, unsigned page, const void * data,
+           unsigned nsectors);
+
+  void clear()
+    { m_sectors.clear(); }
+
+private:
+  ata_device * m_device;
+  std::map<unsigned, std::vector<unsigned char> > m_sectors;
+
+  ata_log_cache(const ata_log_cache &);
+  void operator=(const ata_log_cache &);
+};
+
 // Write GP Log page(s)
 bool ataWriteLogExt(ata_device * device, unsigned char logaddr,
                     unsigned page, void * data, unsigned nsectors);
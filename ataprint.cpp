@@ -3354,6 +3354,57 @@ static void print_standby_timer(const char * msg, int timer, const ata_identify_
 }
 
 
+// Read the GP logs needed by the selected options in one READ LOG EXT
+// command per log and add them to the cache attached to the device.
+// The printers below then read the pages from the cache.
+static void prefetch_gp_logs(ata_device * device, const ata_print_options & options,
+                             const ata_smart_log_directory * gplogdir)
+{
+  ata_log_cache * cache = device->get_log_cache();
+  if (!(cache && gplogdir))
+    return;
+
+  // Device Statistics: page 0 and all requested pages
+  unsigned devstat_nsectors = 0;
+  if (options.devstat_all_pages || options.devstat_ssd_page || !options.devstat_pages.empty()) {
+    unsigned nsectors = GetNumLogSectors(gplogdir, 0x04, true);
+    if (options.devstat_all_pages)
+      devstat_nsectors = nsectors;
+    else {
+      unsigned max_page = (options.devstat_ssd_page ? 0x07 : 0x00);
+      for (int page : options.devstat_pages) {
+        if (max_page < (unsigned)page && (unsigned)page < nsectors)
+          max_page = page;
+      }
+      devstat_nsectors = (max_page < nsectors ? max_page + 1 : nsectors);
+    }
+  }
+
+  // Pending Defects: page 0 and all pages needed for 'max_entries'
+  unsigned pending_nsectors = 0;
+  if (options.pending_defects_log) {
+    unsigned nsectors = GetNumLogSectors(gplogdir, 0x0c, true);
+    unsigned max_page = options.pending_defects_log / 32;
+    pending_nsectors = (max_page < nsectors ? max_page + 1 : nsectors);
+  }
+
+  const struct { unsigned char logaddr; unsigned nsectors; } plan[] = {
+    { 0x04, devstat_nsectors },
+    { 0x0c, pending_nsectors },
+  };
+  for (const auto & p : plan) {
+    unsigned nsectors = p.nsectors;
+    if (!nsectors)
+      continue;
+    if (ata_debugmode)
+      pout("Prefetching GP Log 0x%02x pages 0x00-0x%02x\n", p.logaddr, nsectors - 1);
+    raw_buffer buf(nsectors * 512);
+    // Errors are ignored here, the printer retries and reports them
+    if (ataReadLogExt(device, p.logaddr, 0x00, 0, buf.data(), nsectors))
+      cache->add(p.logaddr, 0, buf.data(), nsectors);
+  }
+}
+
 int ataPrintMain (ata_device * device, const ata_print_options & options)
 {
   // If requested, check power mode first
@@ -4168,6 +4219,10 @@ int ataPrintMain (ata_device * device, const ata_print_options & options)
       gplogdir = &gplogdir_buf;
   }
 
+  // Fetch logs needed below in as few commands as possible
+  ata_log_cache log_cache(device);
+  prefetch_gp_logs(device, options, gplogdir);
+
   // Print log directories
   if ((options.gp_logdir && gplogdir) || (options.smart_logdir && smartlogdir)) {
     if (firmwarebugs.is_set(BUG_NOLOGDIR))
@@ -0,0 +1,648 @@
+/*
+ * dev_capture.cpp
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Record pass-through commands to a capture file and replay them.
+//
+// Capture file format (all integers little endian):
+//
+//   "SMCAPT01"                       magic
+//   u32 protocol                     1=ATA, 2=SCSI, 3=NVMe
+//   u32 nsid                         NVMe namespace id, 0 otherwise
+//   blob dev_name, info_name, dev_type
+//   record...
+//
+// Each record is:
+//
+//   blob key                         protocol specific request
+//   blob data_out                    data sent to the device
+//   u8   ok                          1 if pass-through succeeded
+//   u32  errno
+//   blob errmsg
+//   blob response                    protocol specific response
+//   blob data_in                     data received from the device
+//
+// where a blob is a u32 length followed by the bytes.  The key does not
+// include the data-out payload, so a replayed command matches even if
+// it writes different data (e.g. selective self-test spans).
+
+#include "config.h"
+
+#include "dev_interface.h"
+#include "dev_tunnelled.h"
+#include "scsicmds.h"
+#include "sg_unaligned.h"
+#include "utility.h" // pout()
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+const char * dev_capture_cpp_cvsid = "$Id$";
+
+namespace capture {
+
+const char magic[8] = { 'S', 'M', 'C', 'A', 'P', 'T', '0', '1' };
+
+enum {
+  proto_ata = 1, proto_scsi = 2, proto_nvme = 3
+};
+
+// Sanity limit for a single blob
+const unsigned max_blob_size = 16 * 1024 * 1024;
+
+typedef std::vector<unsigned char> bytes;
+
+/////////////////////////////////////////////////////////////////////////////
+// Serialization helpers
+
+static void put_u8(bytes & b, unsigned x)
+{
+  b.push_back((unsigned char)x);
+}
+
+static void put_u32(bytes & b, unsigned x)
+{
+  unsigned char v[4];
+  sg_put_unaligned_le32(x, v);
+  b.insert(b.end(), v, v + sizeof(v));
+}
+
+static void put_blob(bytes & b, const void * p, unsigned n)
+{
+  put_u32(b, n);
+  const unsigned char * q = (const unsigned char *)p;
+  if (n)
+    b.insert(b.end(), q, q + n);
+}
+
+static void put_blob(bytes & b, const bytes & x)
+{
+  put_blob(b, x.data(), x.size());
+}
+
+static void put_blob(bytes & b, const std::string & s)
+{
+  put_blob(b, s.data(), s.size());
+}
+
+// Read from file, return false on EOF or error
+static bool get_u32(FILE * f, unsigned & x)
+{
+  unsigned char v[4];
+  if (fread(v, 1, sizeof(v), f) != sizeof(v))
+    return false;
+  x = sg_get_unaligned_le32(v);
+  return true;
+}
+
+static bool get_u8(FILE * f, unsigned & x)
+{
+  int c = getc(f);
+  if (c == EOF)
+    return false;
+  x = (unsigned)c;
+  return true;
+}
+
+static bool get_blob(FILE * f, bytes & b)
+{
+  unsigned n;
+  if (!get_u32(f, n) || n > max_blob_size)
+    return false;
+  b.resize(n);
+  return (!n || fread(b.data(), 1, n, f) == n);
+}
+
+static bool get_blob(FILE * f, std::string & s)
+{
+  bytes b;
+  if (!get_blob(f, b))
+    return false;
+  s.assign((const char *)b.data(), b.size());
+  return true;
+}
+
+static unsigned get_le32(const bytes & b, unsigned offset)
+{
+  return (offset + 4 <= b.size() ? sg_get_unaligned_le32(b.data() + offset) : 0);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Protocol specific keys and responses
+
+static void put_ata_regs(bytes & b, const ata_in_regs & r)
+{
+  const ata_register * regs[] = { &r.features, &r.sector_count, &r.lba_low,
+    &r.lba_mid, &r.lba_high, &r.device, &r.command };
+  unsigned set = 0;
+  for (unsigned i = 0; i < sizeof(regs)/sizeof(regs[0]); i++) {
+    put_u8(b, regs[i]->val());
+    if (regs[i]->is_set())
+      set |= 1U << i;
+  }
+  put_u8(b, set);
+}
+
+static void put_ata_regs(bytes & b, const ata_out_regs & r)
+{
+  const ata_register * regs[] = { &r.error, &r.sector_count, &r.lba_low,
+    &r.lba_mid, &r.lba_high, &r.device, &r.status };
+  unsigned set = 0;
+  for (unsigned i = 0; i < sizeof(regs)/sizeof(regs[0]); i++) {
+    put_u8(b, regs[i]->val());
+    if (regs[i]->is_set())
+      set |= 1U << i;
+  }
+  put_u8(b, set);
+}
+
+// Restore registers which were set, return offset of next field
+static unsigned get_ata_regs(const bytes & b, unsigned offset, ata_out_regs & r)
+{
+  ata_register * regs[] = { &r.error, &r.sector_count, &r.lba_low,
+    &r.lba_mid, &r.lba_high, &r.device, &r.status };
+  const unsigned n = sizeof(regs)/sizeof(regs[0]);
+  if (offset + n + 1 > b.size())
+    return b.size();
+  unsigned set = b[offset + n];
+  for (unsigned i = 0; i < n; i++) {
+    if (set & (1U << i))
+      *regs[i] = b[offset + i];
+  }
+  return offset + n + 1;
+}
+
+static bytes ata_key(const ata_cmd_in & in)
+{
+  bytes k;
+  put_ata_regs(k, in.in_regs);
+  put_ata_regs(k, in.in_regs.prev);
+  const ata_out_regs_flags & f = in.out_needed;
+  put_u8(k, (f.error ? 0x01 : 0) | (f.sector_count ? 0x02 : 0) | (f.lba_low ? 0x04 : 0)
+          | (f.lba_mid ? 0x08 : 0) | (f.lba_high ? 0x10 : 0) | (f.device ? 0x20 : 0)
+          | (f.status ? 0x40 : 0));
+  put_u8(k, in.direction);
+  put_u32(k, in.size);
+  return k;
+}
+
+static bytes scsi_key(const scsi_cmnd_io * iop)
+{
+  bytes k;
+  put_blob(k, iop->cmnd, iop->cmnd_len);
+  put_u8(k, iop->dxfer_dir);
+  put_u32(k, iop->dxfer_len);
+  return k;
+}
+
+static bytes nvme_key(const nvme_cmd_in & in)
+{
+  bytes k;
+  put_u8(k, in.opcode);
+  put_u32(k, in.nsid);
+  put_u32(k, in.cdw10); put_u32(k, in.cdw11); put_u32(k, in.cdw12);
+  put_u32(k, in.cdw13); put_u32(k, in.cdw14); put_u32(k, in.cdw15);
+  put_u32(k, in.size);
+  return k;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// capture_writer
+
+/// Append records to a capture file.
+class capture_writer
+{
+public:
+  capture_writer()
+    : m_file(0) { }
+
+  ~capture_writer()
+    { if (m_file) fclose(m_file); }
+
+  bool open(const char * filename, unsigned protocol, unsigned nsid,
+            const smart_device::device_info & info);
+
+  void write_record(const bytes & key, const void * data_out, unsigned out_size,
+                    bool ok, const smart_device::error_info & err,
+                    const bytes & response, const void * data_in, unsigned in_size);
+
+private:
+  FILE * m_file;
+
+  capture_writer(const capture_writer &);
+  void operator=(const capture_writer &);
+};
+
+bool capture_writer::open(const char * filename, unsigned protocol, unsigned nsid,
+                          const smart_device::device_info & info)
+{
+  m_file = fopen(filename, "wb");
+  if (!m_file)
+    return false;
+  bytes h(magic, magic + sizeof(magic));
+  put_u32(h, protocol);
+  put_u32(h, nsid);
+  put_blob(h, info.dev_name);
+  put_blob(h, info.info_name);
+  put_blob(h, info.dev_type);
+  if (fwrite(h.data(), 1, h.size(), m_file) != h.size() || fflush(m_file)) {
+    int err = errno;
+    fclose(m_file); m_file = 0;
+    errno = err;
+    return false;
+  }
+  return true;
+}
+
+void capture_writer::write_record(const bytes & key, const void * data_out, unsigned out_size,
+                                  bool ok, const smart_device::error_info & err,
+                                  const bytes & response, const void * data_in, unsigned in_size)
+{
+  if (!m_file)
+    return;
+  bytes r;
+  put_blob(r, key);
+  put_blob(r, data_out, (data_out ? out_size : 0));
+  put_u8(r, ok);
+  put_u32(r, (ok ? 0 : err.no));
+  put_blob(r, (ok ? std::string() : err.msg));
+  put_blob(r, response);
+  put_blob(r, data_in, (data_in ? in_size : 0));
+  // Flush each record to keep the file usable if the process dies
+  if (fwrite(r.data(), 1, r.size(), m_file) != r.size() || fflush(m_file)) {
+    pout("Write to capture file failed, capture stopped\n");
+    fclose(m_file); m_file = 0;
+  }
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Recording devices
+
+class capture_ata_device
+: public tunnelled_device<ata_device, ata_device>
+{
+public:
+  capture_ata_device(smart_interface * intf, ata_device * atadev)
+    : smart_device(intf, atadev->get_dev_name(), atadev->get_dev_type(),
+                   atadev->get_req_type()),
+      tunnelled_device<ata_device, ata_device>(atadev)
+    { set_info() = atadev->get_info(); }
+
+  virtual bool ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out) override;
+
+  capture_writer writer;
+};
+
+bool capture_ata_device::ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out)
+{
+  bool ok = get_tunnel_dev()->ata_pass_through(in, out);
+  if (!ok)
+    set_err(get_tunnel_dev()->get_err());
+  bytes resp;
+  put_ata_regs(resp, out.out_regs);
+  put_ata_regs(resp, out.out_regs.prev);
+  writer.write_record(ata_key(in),
+    (in.direction == ata_cmd_in::data_out ? in.buffer : 0), in.size, ok, get_err(),
+    resp, (ok && in.direction == ata_cmd_in::data_in ? in.buffer : 0), in.size);
+  return ok;
+}
+
+class capture_scsi_device
+: public tunnelled_device<scsi_device, scsi_device>
+{
+public:
+  capture_scsi_device(smart_interface * intf, scsi_device * scsidev)
+    : smart_device(intf, scsidev->get_dev_name(), scsidev->get_dev_type(),
+                   scsidev->get_req_type()),
+      tunnelled_device<scsi_device, scsi_device>(scsidev)
+    { set_info() = scsidev->get_info(); }
+
+  virtual bool scsi_pass_through(scsi_cmnd_io * iop) override;
+
+  capture_writer writer;
+};
+
+bool capture_scsi_device::scsi_pass_through(scsi_cmnd_io * iop)
+{
+  bool ok = get_tunnel_dev()->scsi_pass_through(iop);
+  if (!ok)
+    set_err(get_tunnel_dev()->get_err());
+  bytes resp;
+  put_u8(resp, iop->scsi_status);
+  put_u32(resp, (unsigned)iop->resid);
+  unsigned sense_len = (iop->sensep ? iop->resp_sense_len : 0);
+  if (sense_len > iop->max_sense_len)
+    sense_len = iop->max_sense_len;
+  put_blob(resp, iop->sensep, sense_len);
+  writer.write_record(scsi_key(iop),
+    (iop->dxfer_dir == DXFER_TO_DEVICE ? iop->dxferp : 0), iop->dxfer_len, ok, get_err(),
+    resp, (ok && iop->dxfer_dir == DXFER_FROM_DEVICE ? iop->dxferp : 0), iop->dxfer_len);
+  return ok;
+}
+
+class capture_nvme_device
+: public tunnelled_device<nvme_device, nvme_device>
+{
+public:
+  capture_nvme_device(smart_interface * intf, nvme_device * nvmedev)
+    : smart_device(intf, nvmedev->get_dev_name(), nvmedev->get_dev_type(),
+                   nvmedev->get_req_type()),
+      tunnelled_device<nvme_device, nvme_device>(nvmedev, nvmedev->get_nsid())
+    { set_info() = nvmedev->get_info(); }
+
+  virtual bool nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out) override;
+
+  capture_writer writer;
+};
+
+bool capture_nvme_device::nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out)
+{
+  bool ok = get_tunnel_dev()->nvme_pass_through(in, out);
+  if (!ok)
+    set_err(get_tunnel_dev()->get_err());
+  bytes resp;
+  put_u32(resp, out.result);
+  put_u32(resp, out.status);
+  put_u8(resp, out.status_valid);
+  unsigned char dir = in.direction();
+  writer.write_record(nvme_key(in),
+    ((dir & nvme_cmd_in::data_out) ? in.buffer : 0), in.size, ok, get_err(),
+    resp, (ok && (dir & nvme_cmd_in::data_in) ? in.buffer : 0), in.size);
+  return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// Replay devices
+
+/// Capture file contents.
+struct capture_data
+{
+  struct record {
+    bytes key, data_out;
+    bool ok;
+    int err_no;
+    std::string errmsg;
+    bytes response, data_in;
+  };
+
+  unsigned protocol, nsid;
+  std::string dev_name, info_name, dev_type;
+  std::vector<record> records;
+
+  capture_data()
+    : protocol(0), nsid(0) { }
+
+  bool read(const char * filename, std::string & errmsg);
+};
+
+bool capture_data::read(const char * filename, std::string & errmsg)
+{
+  FILE * f = fopen(filename, "rb");
+  if (!f) {
+    errmsg = strerror(errno);
+    return false;
+  }
+
+  char m[sizeof(magic)];
+  if (!(   fread(m, 1, sizeof(m), f) == sizeof(m) && !memcmp(m, magic, sizeof(m))
+        && get_u32(f, protocol) && get_u32(f, nsid)
+        && get_blob(f, dev_name) && get_blob(f, info_name) && get_blob(f, dev_type))) {
+    fclose(f);
+    errmsg = "Not a capture file";
+    return false;
+  }
+  if (!(proto_ata <= protocol && protocol <= proto_nvme)) {
+    fclose(f);
+    errmsg = "Unsupported protocol in capture file";
+    return false;
+  }
+
+  for (;;) {
+    record r;
+    unsigned ok, err_no;
+    if (!(   get_blob(f, r.key)
+          && get_blob(f, r.data_out) && get_u8(f, ok) && get_u32(f, err_no)
+          && get_blob(f, r.errmsg) && get_blob(f, r.response) && get_blob(f, r.data_in))) {
+      // EOF or truncated last record, e.g. from interrupted capture
+      break;
+    }
+    r.ok = !!ok; r.err_no = (int)err_no;
+    records.push_back(r);
+  }
+  fclose(f);
+  return true;
+}
+
+/// Common functionality of replay devices.
+class replay_device_base
+: virtual public /*implements*/ smart_device
+{
+protected:
+  explicit replay_device_base(capture_data * data)
+    : smart_device(never_called),
+      m_data(data), m_next(0), m_is_open(false)
+    { set_info().info_name += " [replay of " + data->info_name + "]"; }
+
+public:
+  virtual ~replay_device_base()
+    { delete m_data; }
+
+  virtual bool is_open() const override
+    { return m_is_open; }
+
+  virtual bool open() override
+    { m_is_open = true; return true; }
+
+  virtual bool close() override
+    { m_is_open = false; return true; }
+
+protected:
+  /// Find next record with matching key, set error if not found or failed.
+  const capture_data::record * find_record(const bytes & key);
+
+  capture_data * m_data;
+
+private:
+  unsigned m_next; ///< Index after last matched record
+  bool m_is_open;
+};
+
+const capture_data::record * replay_device_base::find_record(const bytes & key)
+{
+  // Search forward from last match, wrap around once
+  unsigned n = m_data->records.size();
+  for (unsigned i = 0; i < n; i++) {
+    unsigned j = (m_next + i) % n;
+    const capture_data::record & r = m_data->records[j];
+    if (r.key != key)
+      continue;
+    m_next = j + 1;
+    if (!r.ok) {
+      set_err(r.err_no, "%s", r.errmsg.c_str());
+      return 0;
+    }
+    return &r;
+  }
+  set_err(ENOSYS, "Command not found in capture file");
+  return 0;
+}
+
+// Copy recorded data to caller's buffer
+static void copy_data(void * buffer, unsigned size, const bytes & data)
+{
+  if (!buffer || !size)
+    return;
+  unsigned n = (data.size() < size ? data.size() : size);
+  if (n)
+    memcpy(buffer, data.data(), n);
+  if (n < size)
+    memset((char *)buffer + n, 0, size - n);
+}
+
+class replay_ata_device
+: public ata_device,
+  public replay_device_base
+{
+public:
+  replay_ata_device(smart_interface * intf, const char * dev_name, capture_data * data)
+    : smart_device(intf, dev_name, "replay", "replay"),
+      replay_device_base(data)
+    { }
+
+  virtual bool ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out) override;
+};
+
+bool replay_ata_device::ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out)
+{
+  const capture_data::record * r = find_record(ata_key(in));
+  if (!r)
+    return false;
+  unsigned offset = get_ata_regs(r->response, 0, out.out_regs);
+  get_ata_regs(r->response, offset, out.out_regs.prev);
+  if (in.direction == ata_cmd_in::data_in)
+    copy_data(in.buffer, in.size, r->data_in);
+  return true;
+}
+
+class replay_scsi_device
+: public scsi_device,
+  public replay_device_base
+{
+public:
+  replay_scsi_device(smart_interface * intf, const char * dev_name, capture_data * data)
+    : smart_device(intf, dev_name, "replay", "replay"),
+      replay_device_base(data)
+    { }
+
+  virtual bool scsi_pass_through(scsi_cmnd_io * iop) override;
+};
+
+bool replay_scsi_device::scsi_pass_through(scsi_cmnd_io * iop)
+{
+  const capture_data::record * r = find_record(scsi_key(iop));
+  if (!r)
+    return false;
+  const bytes & resp = r->response;
+  iop->scsi_status = (resp.size() > 0 ? resp[0] : 0);
+  iop->resid = (int)get_le32(resp, 1);
+  unsigned sense_len = get_le32(resp, 5);
+  if (9 + sense_len > resp.size())
+    sense_len = 0;
+  if (sense_len > iop->max_sense_len)
+    sense_len = iop->max_sense_len;
+  if (iop->sensep && sense_len)
+    memcpy(iop->sensep, resp.data() + 9, sense_len);
+  iop->resp_sense_len = (iop->sensep ? sense_len : 0);
+  if (iop->dxfer_dir == DXFER_FROM_DEVICE)
+    copy_data(iop->dxferp, iop->dxfer_len, r->data_in);
+  return true;
+}
+
+class replay_nvme_device
+: public nvme_device,
+  public replay_device_base
+{
+public:
+  replay_nvme_device(smart_interface * intf, const char * dev_name, capture_data * data)
+    : smart_device(intf, dev_name, "replay", "replay"),
+      nvme_device(data->nsid),
+      replay_device_base(data)
+    { }
+
+  virtual bool nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out) override;
+};
+
+bool replay_nvme_device::nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out)
+{
+  const capture_data::record * r = find_record(nvme_key(in));
+  if (!r)
+    return false;
+  out.result = get_le32(r->response, 0);
+  out.status = (unsigned short)get_le32(r->response, 4);
+  out.status_valid = (r->response.size() > 8 && r->response[8]);
+  if (in.direction() & nvme_cmd_in::data_in)
+    copy_data(in.buffer, in.size, r->data_in);
+  return true;
+}
+
+} // namespace capture
+
+using namespace capture;
+
+smart_device * smart_interface::get_capture_device(smart_device * dev, const char * filename)
+{
+  // Take temporary ownership of 'dev' to delete it on error
+  smart_device_auto_ptr dev_holder(dev);
+
+  capture_writer * writer; smart_device * capdev; unsigned protocol, nsid = 0;
+  if (dev->is_ata()) {
+    capture_ata_device * d = new capture_ata_device(this, dev->to_ata());
+    writer = &d->writer; capdev = d; protocol = proto_ata;
+  }
+  else if (dev->is_scsi()) {
+    capture_scsi_device * d = new capture_scsi_device(this, dev->to_scsi());
+    writer = &d->writer; capdev = d; protocol = proto_scsi;
+  }
+  else if (dev->is_nvme()) {
+    capture_nvme_device * d = new capture_nvme_device(this, dev->to_nvme());
+    writer = &d->writer; capdev = d; protocol = proto_nvme;
+    nsid = dev->to_nvme()->get_nsid();
+  }
+  else
+    return set_err_np(ENOSYS, "Capture not supported for this device type");
+  // 'dev' is now owned by 'capdev'
+  dev_holder.release();
+  smart_device_auto_ptr capdev_holder(capdev);
+
+  if (!writer->open(filename, protocol, nsid, dev->get_info()))
+    return set_err_np(errno, "%s: %s", filename, strerror(errno));
+  return capdev_holder.release();
+}
+
+smart_device * smart_interface::get_replay_device(const char * name, const char * /*type*/)
+{
+  capture_data * data = new capture_data;
+  std::string errmsg;
+  if (!data->read(name, errmsg)) {
+    delete data;
+    return set_err_np(EINVAL, "%s: %s", name, errmsg.c_str());
+  }
+
+  // 'data' is owned by the new device
+  smart_device * dev;
+  switch (data->protocol) {
+    case proto_ata:  dev = new replay_ata_device(this, name, data); break;
+    case proto_scsi: dev = new replay_scsi_device(this, name, data); break;
+    default:         dev = new replay_nvme_device(this, name, data); break;
+  }
+  return dev;
+}
@@ -32,14 +32,14 @@ int smart_device::s_num_objects = 0;
 
 smart_device::smart_device(smart_interface * intf, const char * dev_name,
     const char * dev_type, const char * req_type)
-: m_intf(intf), m_info(dev_name, dev_type, req_type),
+: m_intf(intf), m_info(dev_name, dev_type, req_type), m_timeout(0),
   m_ata_ptr(0), m_scsi_ptr(0), m_nvme_ptr(0)
 {
   s_num_objects++;
 }
 
 smart_device::smart_device(do_not_use_in_implementation_classes)
-: m_intf(0), m_ata_ptr(0), m_scsi_ptr(0), m_nvme_ptr(0)
+: m_intf(0), m_timeout(0), m_ata_ptr(0), m_scsi_ptr(0), m_nvme_ptr(0)
 {
   throw std::logic_error("smart_device: wrong constructor called in implementation class");
 }
@@ -202,7 +202,7 @@ bool scsi_device::scsi_pass_through_and_check(scsi_cmnd_io * iop,
   unsigned char sense[32] = {0, };
   iop->sensep = sense;
   iop->max_sense_len = sizeof(sense);
-  iop->timeout = SCSI_TIMEOUT_DEFAULT;
+  iop->timeout = (get_timeout() ? get_timeout() : SCSI_TIMEOUT_DEFAULT);
 
   // Run cmd
   if (!scsi_pass_through(iop)) {
@@ -288,6 +288,13 @@ void tunnelled_device_base::release(const smart_device * dev)
     m_tunnel_base_dev = 0;
 }
 
+void tunnelled_device_base::set_timeout(unsigned seconds)
+{
+  smart_device::set_timeout(seconds);
+  if (m_tunnel_base_dev)
+    m_tunnel_base_dev->set_timeout(seconds);
+}
+
 
 /////////////////////////////////////////////////////////////////////////////
 // smart_interface
@@ -307,7 +314,7 @@ std::string smart_interface::get_valid_dev_types_str()
     "ata, scsi[+TYPE], nvme[,NSID], sat[,auto][,N][+TYPE], usbasm1352r,N, usbcypress[,X], "
     "usbjmicron[,p][,x][,N], usbprolific, usbsunplus, sntasmedia, sntjmicron[,NSID], "
     "sntrealtek, jmb39x[-q],N[,sLBA][,force][+TYPE], "
-    "jms56x,N[,sLBA][,force][+TYPE]";
+    "jms56x,N[,sLBA][,force][+TYPE], replay, sim[,ata|scsi|nvme][,OPTION=N]";
   // append custom
   std::string s2 = get_valid_custom_dev_types_str();
   if (!s2.empty()) {
@@ -428,6 +435,12 @@ smart_device * smart_interface::get_smart_device(const char * name, const char *
   else if (!strcmp(type, "scsi"))
     dev = get_scsi_device(name, type);
 
+  else if (!strcmp(type, "replay"))
+    return get_replay_device(name, type);
+
+  else if (!strcmp(type, "sim") || str_starts_with(type, "sim,"))
+    return get_sim_device(name, type);
+
   else if (str_starts_with(type, "nvme")) {
     int n1 = -1, n2 = -1, len = strlen(type);
     unsigned nsid = 0; // invalid namespace id -> use default
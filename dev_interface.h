@@ -176,6 +176,19 @@ public:
   static int get_num_objects()
     { return s_num_objects; }
 
+  ///////////////////////////////////////////////
+  // Command timeout
+
+  /// Set timeout in seconds for pass-through commands which would
+  /// otherwise use the default timeout, 0 to use the defaults.
+  /// Ignored by interfaces without timeout support.
+  virtual void set_timeout(unsigned seconds)
+    { m_timeout = seconds; }
+
+  /// Get command timeout in seconds, 0 if default.
+  unsigned get_timeout() const
+    { return m_timeout; }
+
 // Operations
 public:
   ///////////////////////////////////////////////
@@ -232,6 +245,7 @@ private:
   smart_interface * m_intf;
   device_info m_info;
   error_info m_err;
+  unsigned m_timeout;
 
   // Pointers for to_ata(), to_scsi(), to_nvme()
   // set by ATA/SCSI/NVMe interface classes.
@@ -509,6 +523,8 @@ struct ata_cmd_out
   ata_cmd_out();
 };
 
+class ata_log_cache;
+
 /// ATA device access
 class ata_device
 : virtual public /*extends*/ smart_device
@@ -528,6 +544,22 @@ public:
   /// Default implementation returns false.
   virtual bool ata_identify_is_cached() const;
 
+  /// Return true if multi-sector READ LOG EXT failed before but
+  /// single sector reads worked.
+  bool single_sector_log_ext() const
+    { return m_single_sector_log_ext; }
+
+  /// Set if multi-sector READ LOG EXT should not be used.
+  void set_single_sector_log_ext(bool single = true)
+    { m_single_sector_log_ext = single; }
+
+  /// Get attached GP log cache, nullptr if none.
+  ata_log_cache * get_log_cache() const
+    { return m_log_cache; }
+  /// Attach GP log cache, nullptr to detach.
+  void set_log_cache(ata_log_cache * cache)
+    { m_log_cache = cache; }
+
 protected:
   /// Flags for ata_cmd_is_supported().
   enum {
@@ -565,8 +597,14 @@ protected:
 
   /// Default constructor, registers device as ATA.
   ata_device()
-    : smart_device(never_called)
+    : smart_device(never_called),
+      m_single_sector_log_ext(false),
+      m_log_cache(nullptr)
     { hide_ata(false); }
+
+private:
+  bool m_single_sector_log_ext;
+  ata_log_cache * m_log_cache;
 };
 
 
@@ -574,6 +612,7 @@ protected:
 // SCSI specific interface
 
 struct scsi_cmnd_io;
+class scsi_log_cache;
 
 enum scsi_cmd_support
 {
@@ -582,6 +621,62 @@ enum scsi_cmd_support
   SC_SUPPORT,
 };
 
+/// Supported SCSI log pages, subpages and VPD pages of a device
+/// and known response lengths of log pages.
+/// Filled and used by functions in scsicmds.cpp.
+class scsi_page_support
+{
+public:
+  scsi_page_support()
+    : m_log_known(0), m_vpd_known(false), m_log_pages(), m_vpd_pages() { }
+
+  /// Return true if supported log pages were read.
+  bool log_pages_known() const
+    { return (m_log_known >= 1); }
+  /// Return true if supported log pages and subpages were read.
+  bool log_subpages_known() const
+    { return (m_log_known >= 2); }
+  /// Set log_pages_known() or log_subpages_known().
+  void set_log_pages_known(bool subpages)
+    { m_log_known = (subpages ? 2 : 1); }
+  /// Remove all log pages.
+  void clear_log_pages();
+
+  /// Return true if log page and subpage is supported.
+  bool is_log_page_supported(int page, int subpage = 0) const;
+  /// Add supported log page and subpage.
+  void add_log_page(int page, int subpage = 0);
+  /// Get supported log pages as (page << 8 | subpage) in reported order.
+  const std::vector<unsigned short> & get_log_pages() const
+    { return m_log_list; }
+
+  /// Return true if supported VPD pages were read.
+  bool vpd_pages_known() const
+    { return m_vpd_known; }
+  /// Set vpd_pages_known().
+  void set_vpd_pages_known()
+    { m_vpd_known = true; }
+  /// Return true if VPD page is supported.
+  bool is_vpd_page_supported(int page) const
+    { return !!((m_vpd_pages[(page >> 5) & 0x7] >> (page & 0x1f)) & 1); }
+  /// Add supported VPD page.
+  void add_vpd_page(int page)
+    { m_vpd_pages[(page >> 5) & 0x7] |= 1U << (page & 0x1f); }
+
+  /// Get known response length of log page, 0 if unknown.
+  int get_log_resp_len(int page, int subpage) const;
+  /// Set known response length of log page.
+  void set_log_resp_len(int page, int subpage, int len);
+
+private:
+  unsigned char m_log_known; ///< 0: unknown, 1: pages, 2: pages and subpages
+  bool m_vpd_known;
+  unsigned m_log_pages[2]; ///< Bitmap of log pages with subpage 0
+  std::vector<unsigned short> m_log_list; ///< All log pages and subpages
+  unsigned m_vpd_pages[8]; ///< Bitmap of VPD pages
+  std::vector<unsigned> m_resp_lens; ///< (page << 24 | subpage << 16 | len)
+};
+
 /// SCSI device access
 class scsi_device
 : virtual public /*extends*/ smart_device
@@ -615,6 +710,20 @@ public:
                                           uint16_t sa,
                                           bool for_lsense_spc = false) const;
 
+  /// Get supported log and VPD pages.
+  const scsi_page_support & page_support() const
+    { return m_page_support; }
+  /// R/W access to supported log and VPD pages.
+  scsi_page_support & page_support()
+    { return m_page_support; }
+
+  /// Get attached LOG SENSE response cache, nullptr if none.
+  scsi_log_cache * get_log_cache() const
+    { return m_log_cache; }
+  /// Attach LOG SENSE response cache, nullptr to detach.
+  void set_log_cache(scsi_log_cache * cache)
+    { m_log_cache = cache; }
+
 protected:
   /// Hide/unhide SCSI interface.
   void hide_scsi(bool hide = true)
@@ -631,7 +740,8 @@ protected:
       logsense_spc_sup(SC_SUPPORT_UNKNOWN),
       rcap16_sup(SC_SUPPORT_UNKNOWN),
       rdefect10_sup(SC_SUPPORT_UNKNOWN),
-      rdefect12_sup(SC_SUPPORT_UNKNOWN)
+      rdefect12_sup(SC_SUPPORT_UNKNOWN),
+      m_log_cache(nullptr)
     { hide_scsi(false); }
 
 private:
@@ -645,6 +755,9 @@ private:
   scsi_cmd_support rcap16_sup;
   scsi_cmd_support rdefect10_sup;
   scsi_cmd_support rdefect12_sup;
+
+  scsi_page_support m_page_support;
+  scsi_log_cache * m_log_cache;
 };
 
 
@@ -1080,7 +1193,22 @@ protected:
   virtual ata_device * get_jmb39x_device(const char * type, smart_device * smartdev);
   //{ implemented in dev_jmb39x_raid.cpp }
 
+  /// Return device which replays commands from capture file 'name'.
+  virtual smart_device * get_replay_device(const char * name, const char * type);
+  //{ implemented in dev_capture.cpp }
+
+  /// Return simulated device for 'sim[,...]' type.
+  virtual smart_device * get_sim_device(const char * name, const char * type);
+  //{ implemented in dev_sim.cpp }
+
 public:
+  /// Return device which records all pass-through commands of the
+  /// open device 'dev' to capture file 'filename'.
+  /// The result can be replayed with '-d replay'.
+  /// Return 0 and delete 'dev' on error.
+  virtual smart_device * get_capture_device(smart_device * dev, const char * filename);
+  //{ implemented in dev_capture.cpp }
+
   /// Try to detect a SAT device behind a SCSI interface.
   /// Inquiry data can be passed if available.
   /// Return appropriate device if yes, otherwise 0.
@@ -0,0 +1,958 @@
+/*
+ * dev_sim.cpp
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+// Simulated ATA, SCSI and NVMe devices for testing and benchmarking.
+//
+// Device type syntax (arguments in any order):
+//   sim[,ata|scsi|nvme][,delay=MS][,fail=N][,hang=N][,hangafter=N][,hangtime=MS]
+//      [,grow=N][,health=N][,standby=N][,testtime=N]
+//
+// delay=MS:    Add MS milliseconds latency to each command.
+// fail=N:      Fail every Nth command with EIO.
+// hang=N:      Block every Nth command for 'hangtime' milliseconds
+//              (default 5000), then fail with ETIMEDOUT.  The command
+//              timeout of the device limits the blocking time.
+// hangafter=N: Block all commands after the first N commands like
+//              'hang=1' (device stops responding).
+// grow=N:      Every Nth read of SMART/health data increases the
+//              reallocated and pending sector counts and the error
+//              log count.
+// health=N:    SMART health status fails after N reads of SMART/health
+//              data.
+// standby=N:   ATA CHECK POWER MODE reports STANDBY if N is nonzero.
+// testtime=N:  ATA self-tests run for N reads of SMART data instead of
+//              completing immediately.  A selective self-test advances
+//              the current LBA accordingly.
+//
+// The temperature cycles between 30 and 39 Celsius, the power on hours
+// increase by one with each read of SMART/health data.
+
+#include "config.h"
+
+#include "atacmds.h" // ATA_* command codes
+#include "dev_interface.h"
+#include "dev_sim.h"
+#include "nvmecmds.h"
+#include "scsicmds.h"
+#include "sg_unaligned.h"
+#include "utility.h"
+
+#include <errno.h>
+#include <stddef.h> // offsetof()
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h> // Sleep()
+#else
+#include <time.h> // nanosleep()
+#endif
+
+const char * dev_sim_cpp_cvsid = "$Id$";
+
+namespace sim {
+
+static sim_device_stats stats;
+
+// Simulated capacity (1TB, 512 byte sectors)
+const uint64_t num_sectors = 1953525168;
+
+static void sleep_msec(unsigned msec)
+{
+#ifdef _WIN32
+  Sleep(msec);
+#else
+  struct timespec ts;
+  ts.tv_sec = msec / 1000;
+  ts.tv_nsec = (long)(msec % 1000) * 1000000L;
+  while (nanosleep(&ts, &ts) && errno == EINTR)
+    ;
+#endif
+}
+
+// Copy response to caller's buffer, clear remaining bytes
+static void copy_response(void * buffer, unsigned size, const void * data, unsigned len)
+{
+  if (!buffer || !size)
+    return;
+  unsigned n = (len < size ? len : size);
+  memcpy(buffer, data, n);
+  if (n < size)
+    memset((char *)buffer + n, 0, size - n);
+}
+
+// Set ATA string (two characters per word, swapped)
+static void put_ata_string(unsigned char * buf, unsigned word, const char * str, unsigned nwords)
+{
+  unsigned len = strlen(str);
+  for (unsigned i = 0; i < 2 * nwords; i++)
+    buf[2 * word + (i ^ 1)] = (i < len ? str[i] : ' ');
+}
+
+// Set space padded string
+static void put_string(void * buf, const char * str, unsigned size)
+{
+  unsigned len = strlen(str);
+  memset(buf, ' ', size);
+  memcpy(buf, str, (len < size ? len : size));
+}
+
+// Set 8-bit checksum in last byte of 512 byte sector
+static void put_checksum(unsigned char * buf)
+{
+  unsigned char sum = 0;
+  for (int i = 0; i < 511; i++)
+    sum += buf[i];
+  buf[511] = (unsigned char)-sum;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// sim_device_base
+
+/// Common functionality of all simulated devices.
+class sim_device_base
+: virtual public /*implements*/ smart_device
+{
+protected:
+  explicit sim_device_base(const char * type);
+
+public:
+  virtual bool is_open() const override
+    { return m_is_open; }
+
+  virtual bool open() override
+    { m_is_open = true; return true; }
+
+  virtual bool close() override
+    { m_is_open = false; return true; }
+
+  /// Return false and set error message if 'type' was invalid.
+  bool check_type(std::string & errmsg) const;
+
+protected:
+  /// Count command, add latency, inject failure or hang.
+  /// Return false on injected failure.
+  bool begin_command();
+
+  /// Update simulated values on each read of SMART/health data.
+  void next_cycle();
+
+  /// Add self-test result to self-test log.
+  void add_selftest(unsigned char type, unsigned char status);
+
+  struct selftest_entry {
+    unsigned char type, status;
+    unsigned hours;
+  };
+
+  // Simulated values
+  std::string m_serial; ///< Serial number derived from device name
+  unsigned m_cycles; ///< Number of SMART/health data reads
+  unsigned m_hours; ///< Power on hours
+  unsigned m_realloc, m_pending; ///< Sector counts
+  unsigned m_errors; ///< Error log count
+  bool m_failing; ///< SMART health failed
+  bool m_standby; ///< ATA power mode is STANDBY
+  std::vector<selftest_entry> m_selftests; ///< [0] = newest
+
+  unsigned temperature() const
+    { return 30 + m_cycles % 10; }
+
+  unsigned m_testtime; ///< Self-test duration in cycles, 0 = immediate
+
+private:
+  bool m_is_open;
+  std::string m_badarg;
+  unsigned m_delay, m_fail, m_hang, m_hangafter, m_hangtime, m_grow, m_health;
+  uint64_t m_commands;
+};
+
+sim_device_base::sim_device_base(const char * type)
+: smart_device(never_called),
+  m_cycles(0), m_hours(1000), m_realloc(0), m_pending(0), m_errors(0),
+  m_failing(false), m_standby(false), m_testtime(0), m_is_open(false),
+  m_delay(0), m_fail(0), m_hang(0), m_hangafter(0), m_hangtime(5000), m_grow(0), m_health(0),
+  m_commands(0)
+{
+  // Derive a stable serial number from the device name (FNV-1a)
+  uint32_t h = 0x811c9dc5;
+  for (const char * p = get_dev_name(); *p; p++)
+    h = (h ^ (unsigned char)*p) * 0x01000193;
+  m_serial = strprintf("SIM%08X", h);
+
+  // Parse "sim[,PROTOCOL][,KEY=VALUE...]"
+  const char * s = type + 3;
+  while (*s == ',') {
+    s++;
+    int n = -1; unsigned val = 0;
+    char key[16] = "";
+    std::string arg(s, strcspn(s, ","));
+    if (arg == "ata" || arg == "scsi" || arg == "nvme") {
+      // Protocol, already handled by factory
+      s += arg.size();
+      continue;
+    }
+    sscanf(s, "%15[a-z]=%u%n", key, &val, &n);
+    if (n <= 0 || !(s[n] == ',' || !s[n])) {
+      m_badarg = s;
+      return;
+    }
+    if      (!strcmp(key, "delay"))    m_delay = val;
+    else if (!strcmp(key, "fail"))     m_fail = val;
+    else if (!strcmp(key, "hang"))     m_hang = val;
+    else if (!strcmp(key, "hangafter")) m_hangafter = val;
+    else if (!strcmp(key, "hangtime")) m_hangtime = val;
+    else if (!strcmp(key, "grow"))     m_grow = val;
+    else if (!strcmp(key, "health"))   m_health = val;
+    else if (!strcmp(key, "standby"))  m_standby = !!val;
+    else if (!strcmp(key, "testtime")) m_testtime = val;
+    else {
+      m_badarg = s;
+      return;
+    }
+    s += n;
+  }
+  if (*s)
+    m_badarg = s;
+
+  stats.devices++;
+}
+
+bool sim_device_base::check_type(std::string & errmsg) const
+{
+  if (m_badarg.empty())
+    return true;
+  errmsg = strprintf("Invalid argument '%s'", m_badarg.c_str());
+  return false;
+}
+
+bool sim_device_base::begin_command()
+{
+  m_commands++; stats.commands++;
+  if (m_delay) {
+    sleep_msec(m_delay);
+    stats.delay_usec += m_delay * 1000ULL;
+  }
+  if (   (m_hang && !(m_commands % m_hang))
+      || (m_hangafter && m_commands > m_hangafter)) {
+    stats.hangs++;
+    unsigned msec = m_hangtime;
+    if (get_timeout() && get_timeout() * 1000 < msec)
+      msec = get_timeout() * 1000;
+    sleep_msec(msec);
+    stats.delay_usec += msec * 1000ULL;
+    return set_err(ETIMEDOUT, "Simulated command timeout");
+  }
+  if (m_fail && !(m_commands % m_fail)) {
+    stats.failures++;
+    return set_err(EIO, "Simulated I/O error");
+  }
+  return true;
+}
+
+void sim_device_base::next_cycle()
+{
+  m_cycles++;
+  m_hours++;
+  if (m_grow && !(m_cycles % m_grow)) {
+    m_realloc++;
+    m_pending = (m_pending ? 0 : 1);
+    m_errors++;
+  }
+  if (m_health && m_cycles >= m_health)
+    m_failing = true;
+}
+
+void sim_device_base::add_selftest(unsigned char type, unsigned char status)
+{
+  selftest_entry e;
+  e.type = type; e.status = status; e.hours = m_hours;
+  m_selftests.insert(m_selftests.begin(), e);
+  if (m_selftests.size() > 20)
+    m_selftests.resize(20);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// sim_ata_device
+
+class sim_ata_device
+: public ata_device,
+  public sim_device_base
+{
+public:
+  sim_ata_device(smart_interface * intf, const char * dev_name, const char * type)
+    : smart_device(intf, dev_name, "sim", type),
+      sim_device_base(type),
+      m_test_type(0), m_test_left(0)
+    {
+      memset(m_sel_log, 0, sizeof(m_sel_log));
+      sg_put_unaligned_le16(0x0001, m_sel_log);
+    }
+
+  virtual bool ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out) override;
+
+private:
+  void get_identify(unsigned char * buf) const;
+  void get_smart_values(unsigned char * buf) const;
+  void get_smart_thresholds(unsigned char * buf) const;
+  bool get_smart_log(unsigned char addr, unsigned char * buf) const;
+  bool get_gp_log(unsigned char addr, unsigned page, unsigned char * buf) const;
+  void start_selftest(unsigned char type);
+  void next_selftest_cycle();
+
+  unsigned char m_test_type; ///< Running self-test, 0 if none
+  unsigned m_test_left; ///< Remaining cycles of running self-test
+  unsigned char m_sel_log[512]; ///< Selective self-test log
+};
+
+struct sim_attribute {
+  unsigned char id;
+  unsigned short flags;
+  unsigned char threshold;
+};
+
+const sim_attribute ata_attributes[] = {
+  {   1, 0x000f, 6 }, // Raw_Read_Error_Rate
+  {   5, 0x0033, 36 }, // Reallocated_Sector_Ct
+  {   9, 0x0032, 0 }, // Power_On_Hours
+  {  12, 0x0032, 0 }, // Power_Cycle_Count
+  { 194, 0x0022, 0 }, // Temperature_Celsius
+  { 197, 0x0012, 0 }, // Current_Pending_Sector
+  { 198, 0x0010, 0 }, // Offline_Uncorrectable
+  { 199, 0x003e, 0 }, // UDMA_CRC_Error_Count
+};
+
+const unsigned num_ata_attributes = sizeof(ata_attributes) / sizeof(ata_attributes[0]);
+
+void sim_ata_device::get_identify(unsigned char * buf) const
+{
+  memset(buf, 0, 512);
+  sg_put_unaligned_le16(0x0040, buf + 2*0); // Fixed device
+  sg_put_unaligned_le16(16383, buf + 2*1);
+  sg_put_unaligned_le16(16, buf + 2*3);
+  sg_put_unaligned_le16(63, buf + 2*6);
+  put_ata_string(buf, 10, m_serial.c_str(), 10);
+  put_ata_string(buf, 23, "SIM1.0", 4);
+  put_ata_string(buf, 27, "SIMULATED ATA DISK", 20);
+  sg_put_unaligned_le16(0x0f00, buf + 2*49); // LBA, DMA
+  sg_put_unaligned_le16(0x0007, buf + 2*53);
+  sg_put_unaligned_le32(0x0fffffff, buf + 2*60);
+  sg_put_unaligned_le16(0x01f0, buf + 2*80); // ATA-4 to ATA8-ACS
+  sg_put_unaligned_le16(0x4001, buf + 2*82); // SMART supported
+  sg_put_unaligned_le16(0x4400, buf + 2*83); // 48-bit
+  sg_put_unaligned_le16(0x4023, buf + 2*84); // SMART error log, self-test, GPL
+  sg_put_unaligned_le16(0x0001, buf + 2*85); // SMART enabled
+  sg_put_unaligned_le16(0x0400, buf + 2*86);
+  sg_put_unaligned_le16(0x4023, buf + 2*87);
+  sg_put_unaligned_le64(num_sectors, buf + 2*100);
+  sg_put_unaligned_le16(7200, buf + 2*217); // Rotation rate
+}
+
+void sim_ata_device::get_smart_values(unsigned char * buf) const
+{
+  memset(buf, 0, 512);
+  sg_put_unaligned_le16(0x0010, buf);
+  for (unsigned i = 0; i < num_ata_attributes; i++) {
+    unsigned char * a = buf + 2 + 12 * i;
+    unsigned char val = 100; uint64_t raw = 0;
+    switch (ata_attributes[i].id) {
+      case   5: raw = m_realloc;
+                val = (m_failing ? 30 : 100 - (m_realloc < 60 ? m_realloc : 60)); break;
+      case   9: raw = m_hours; val = 99; break;
+      case  12: raw = 10; break;
+      case 194: raw = temperature(); val = 100 - temperature(); break;
+      case 197: raw = m_pending; break;
+      case 198: raw = (m_realloc ? 1 : 0); break;
+      case 199: val = 200; break;
+    }
+    a[0] = ata_attributes[i].id;
+    sg_put_unaligned_le16(ata_attributes[i].flags, a + 1);
+    a[3] = val; a[4] = val;
+    sg_put_unaligned_le48(raw, a + 5);
+  }
+  buf[362] = 0x82; // Offline data collection completed
+  if (m_test_type) // Self-test in progress, remaining tenths
+    buf[363] = 0xf0 | (m_test_left * 10 + m_testtime - 1) / m_testtime;
+  else
+    buf[363] = 0x00; // Self-test completed without error
+  sg_put_unaligned_le16(600, buf + 364);
+  buf[367] = 0x5b; // Offline, self-tests, selective self-tests
+  sg_put_unaligned_le16(0x0003, buf + 368);
+  buf[370] = 0x01; // Error logging supported
+  buf[372] = 2; // Short self-test minutes
+  buf[373] = 120; // Extended self-test minutes
+  put_checksum(buf);
+}
+
+void sim_ata_device::get_smart_thresholds(unsigned char * buf) const
+{
+  memset(buf, 0, 512);
+  sg_put_unaligned_le16(0x0010, buf);
+  for (unsigned i = 0; i < num_ata_attributes; i++) {
+    buf[2 + 12 * i] = ata_attributes[i].id;
+    buf[2 + 12 * i + 1] = ata_attributes[i].threshold;
+  }
+  put_checksum(buf);
+}
+
+bool sim_ata_device::get_smart_log(unsigned char addr, unsigned char * buf) const
+{
+  memset(buf, 0, 512);
+  switch (addr) {
+    case 0x00: // Log directory
+      sg_put_unaligned_le16(0x0001, buf);
+      buf[2 * 0x01] = 1;
+      buf[2 * 0x06] = 1;
+      buf[2 * 0x09] = 1;
+      return true;
+
+    case 0x01: // Summary error log
+      buf[0] = 0x01;
+      if (m_errors) {
+        // One entry: READ DMA, UNC error
+        buf[1] = 1;
+        unsigned char * e = buf + 2;
+        e[4 * 12 + 6] = 0xe0; // Device register
+        e[4 * 12 + 7] = 0xc8; // READ DMA
+        e[60 + 1] = 0x40; // Error register: UNC
+        e[60 + 6] = 0xe0;
+        e[60 + 7] = 0x51; // Status register
+        e[60 + 27] = 0x03; // Active or idle
+        sg_put_unaligned_le16((unsigned short)m_hours, e + 60 + 28);
+      }
+      sg_put_unaligned_le16((unsigned short)m_errors, buf + 452);
+      put_checksum(buf);
+      return true;
+
+    case 0x06: // Self-test log
+      sg_put_unaligned_le16(0x0001, buf);
+      // Circular buffer, most recent entry is 'mostrecenttest'
+      for (unsigned i = 0; i < m_selftests.size(); i++) {
+        unsigned n = m_selftests.size() - 1 - i; // oldest first
+        unsigned char * e = buf + 2 + 24 * i;
+        e[0] = m_selftests[n].type;
+        e[1] = m_selftests[n].status;
+        sg_put_unaligned_le16((unsigned short)m_selftests[n].hours, e + 2);
+      }
+      buf[508] = (unsigned char)m_selftests.size();
+      put_checksum(buf);
+      return true;
+
+    case 0x09: // Selective self-test log
+      memcpy(buf, m_sel_log, 512);
+      if (m_test_type == 0x04 || m_test_type == 0x84) {
+        // Span 1 is tested, current LBA advances with each cycle
+        uint64_t start = sg_get_unaligned_le64(buf + 2), end = sg_get_unaligned_le64(buf + 10);
+        uint64_t done = (end - start) / m_testtime * (m_testtime - m_test_left);
+        sg_put_unaligned_le64(start + done, buf + 492);
+        sg_put_unaligned_le16(1, buf + 500);
+      }
+      put_checksum(buf);
+      return true;
+  }
+  return false;
+}
+
+void sim_ata_device::start_selftest(unsigned char type)
+{
+  if (type == 0x7f) { // Abort
+    if (m_test_type)
+      add_selftest(m_test_type, 0x10); // Aborted by host
+    m_test_type = 0;
+    return;
+  }
+  if (!type) // Offline data collection
+    return;
+  if (!m_testtime) {
+    // Self-tests complete immediately
+    add_selftest(type, (m_failing ? 0x70 : 0x00));
+    return;
+  }
+  m_test_type = type;
+  m_test_left = m_testtime;
+}
+
+void sim_ata_device::next_selftest_cycle()
+{
+  if (!(m_test_type && !--m_test_left))
+    return;
+  add_selftest(m_test_type, (m_failing ? 0x70 : 0x00));
+  m_test_type = 0;
+}
+
+bool sim_ata_device::get_gp_log(unsigned char addr, unsigned page,
+                                unsigned char * buf) const
+{
+  memset(buf, 0, 512);
+  switch (addr) {
+    case 0x00: // Log directory
+      if (page)
+        break;
+      sg_put_unaligned_le16(0x0001, buf);
+      sg_put_unaligned_le16(8, buf + 2 * 0x04);
+      sg_put_unaligned_le16(2, buf + 2 * 0x0c);
+      return true;
+
+    case 0x04: // Device Statistics
+      switch (page) {
+        case 0x00: // Supported pages
+          sg_put_unaligned_le16(0x0001, buf);
+          buf[8] = 2; buf[9] = 0x00; buf[10] = 0x01;
+          return true;
+        case 0x01: // General Statistics
+          sg_put_unaligned_le16(0x0001, buf);
+          buf[2] = 0x01;
+          sg_put_unaligned_le64(0xc000000000000000ULL | 10, buf + 8);
+          sg_put_unaligned_le64(0xc000000000000000ULL | m_hours, buf + 16);
+          return true;
+      }
+      if (page < 8)
+        return true; // Not supported
+      break;
+
+    case 0x0c: // Pending Defects
+      if (page > 1)
+        break;
+      if (!page) {
+        sg_put_unaligned_le32(m_pending, buf);
+        if (m_pending) {
+          sg_put_unaligned_le32(m_hours, buf + 16);
+          sg_put_unaligned_le64(num_sectors / 2, buf + 16 + 8);
+        }
+      }
+      return true;
+  }
+  return false;
+}
+
+bool sim_ata_device::ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out)
+{
+  if (!ata_cmd_is_ok(in, true /*data_out_support*/, true /*multi_sector_support*/,
+                     true /*ata_48bit_support*/))
+    return false;
+  if (!begin_command())
+    return false;
+
+  unsigned char buf[512];
+  const ata_in_regs & r = in.in_regs;
+  switch (r.command) {
+    case ATA_IDENTIFY_DEVICE:
+      get_identify(buf);
+      copy_response(in.buffer, in.size, buf, sizeof(buf));
+      return true;
+
+    case ATA_CHECK_POWER_MODE:
+      out.out_regs.sector_count = (m_standby ? 0x00 : 0xff); // Standby, active or idle
+      return true;
+
+    case ATA_SMART_CMD:
+      switch (r.features) {
+        case ATA_SMART_ENABLE:
+        case ATA_SMART_AUTOSAVE:
+        case ATA_SMART_AUTO_OFFLINE:
+          return true;
+
+        case ATA_SMART_STATUS:
+          out.out_regs.lba_mid  = (m_failing ? 0xf4 : 0x4f);
+          out.out_regs.lba_high = (m_failing ? 0x2c : 0xc2);
+          return true;
+
+        case ATA_SMART_READ_VALUES:
+          next_cycle();
+          next_selftest_cycle();
+          get_smart_values(buf);
+          copy_response(in.buffer, in.size, buf, sizeof(buf));
+          return true;
+
+        case ATA_SMART_READ_THRESHOLDS:
+          get_smart_thresholds(buf);
+          copy_response(in.buffer, in.size, buf, sizeof(buf));
+          return true;
+
+        case ATA_SMART_READ_LOG_SECTOR:
+          if (!get_smart_log(r.lba_low, buf))
+            break;
+          copy_response(in.buffer, in.size, buf, sizeof(buf));
+          return true;
+
+        case ATA_SMART_WRITE_LOG_SECTOR:
+          if (r.lba_low != 0x09 || in.size != 512)
+            break;
+          memcpy(m_sel_log, in.buffer, 512);
+          return true;
+
+        case ATA_SMART_IMMEDIATE_OFFLINE:
+          start_selftest(r.lba_low);
+          return true;
+      }
+      break;
+
+    case ATA_READ_LOG_EXT:
+      for (unsigned i = 0; i < in.size / 512; i++) {
+        unsigned page = in.in_regs.lba_mid_16 + i;
+        if (!get_gp_log(r.lba_low, page, buf))
+          return set_err(EIO, "Simulated device: GP Log 0x%02x page %u not supported",
+                         r.lba_low.val(), page);
+        memcpy((char *)in.buffer + 512 * i, buf, sizeof(buf));
+      }
+      return true;
+  }
+  return set_err(EIO, "Simulated device: Command 0x%02x/0x%02x not supported",
+                 r.command.val(), r.features.val());
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// sim_scsi_device
+
+class sim_scsi_device
+: public scsi_device,
+  public sim_device_base
+{
+public:
+  sim_scsi_device(smart_interface * intf, const char * dev_name, const char * type)
+    : smart_device(intf, dev_name, "sim", type),
+      sim_device_base(type)
+    { }
+
+  virtual bool scsi_pass_through(scsi_cmnd_io * iop) override;
+
+private:
+  bool get_log_page(unsigned char page, std::vector<unsigned char> & resp) const;
+};
+
+bool sim_scsi_device::get_log_page(unsigned char page, std::vector<unsigned char> & resp) const
+{
+  static const unsigned char supported[] = {
+    SUPPORTED_LPAGES, TEMPERATURE_LPAGE, SELFTEST_RESULTS_LPAGE, IE_LPAGE
+  };
+  resp.assign(4, 0);
+  resp[0] = page;
+  switch (page) {
+    case SUPPORTED_LPAGES:
+      resp.insert(resp.end(), supported, supported + sizeof(supported));
+      break;
+
+    case TEMPERATURE_LPAGE:
+      {
+        const unsigned char p[] = {
+          0x00, 0x00, 0x03, 0x02, 0x00, (unsigned char)temperature(), // Current
+          0x00, 0x01, 0x03, 0x02, 0x00, 60 // Reference
+        };
+        resp.insert(resp.end(), p, p + sizeof(p));
+      }
+      break;
+
+    case SELFTEST_RESULTS_LPAGE:
+      for (unsigned i = 0; i < 20; i++) {
+        unsigned char p[20] = { 0, (unsigned char)(i + 1), 0x03, 0x10, };
+        if (i < m_selftests.size()) {
+          const selftest_entry & e = m_selftests[i];
+          p[4] = (unsigned char)((e.type << 5) | e.status);
+          p[5] = (unsigned char)(m_selftests.size() - i); // Self-test number
+          sg_put_unaligned_be16((unsigned short)e.hours, p + 6);
+        }
+        resp.insert(resp.end(), p, p + sizeof(p));
+      }
+      break;
+
+    case IE_LPAGE:
+      {
+        const unsigned char p[] = {
+          0x00, 0x00, 0x03, 0x04,
+          (unsigned char)(m_failing ? SCSI_ASC_IMPENDING_FAILURE : 0), 0,
+          (unsigned char)temperature(), 60
+        };
+        resp.insert(resp.end(), p, p + sizeof(p));
+      }
+      break;
+
+    default:
+      return false;
+  }
+  sg_put_unaligned_be16(resp.size() - 4, &resp[2]);
+  return true;
+}
+
+bool sim_scsi_device::scsi_pass_through(scsi_cmnd_io * iop)
+{
+  if (!begin_command())
+    return false;
+
+  const unsigned char * cdb = iop->cmnd;
+  std::vector<unsigned char> resp;
+  iop->resid = 0;
+  iop->scsi_status = 0;
+  iop->resp_sense_len = 0;
+
+  bool ok = true;
+  switch (cdb[0]) {
+    case TEST_UNIT_READY:
+    case SEND_DIAGNOSTIC:
+      if (cdb[0] == SEND_DIAGNOSTIC && (cdb[1] >> 5))
+        add_selftest(cdb[1] >> 5, (m_failing ? 0x7 : 0x0));
+      break;
+
+    case INQUIRY:
+      if (!(cdb[1] & 0x01)) {
+        // Standard INQUIRY
+        resp.assign(36, 0);
+        resp[2] = 0x06; // SPC-4
+        resp[3] = 0x02;
+        resp[4] = 31;
+        put_string(&resp[8], "SIM", 8);
+        put_string(&resp[16], "SIMULATED DISK", 16);
+        put_string(&resp[32], "1.00", 4);
+      }
+      else if (cdb[2] == 0x00) {
+        const unsigned char p[] = { 0x00, 0x00, 0x00, 3, 0x00, 0x80, 0x83 };
+        resp.assign(p, p + sizeof(p));
+      }
+      else if (cdb[2] == 0x80) {
+        const unsigned char p[] = { 0x00, 0x80, 0x00, (unsigned char)m_serial.size() };
+        resp.assign(p, p + sizeof(p));
+        resp.insert(resp.end(), m_serial.begin(), m_serial.end());
+      }
+      else if (cdb[2] == 0x83) {
+        // NAA designator derived from serial number
+        unsigned char p[16] = { 0x00, 0x83, 0x00, 12, 0x01, 0x03, 0x00, 8, 0x50, 0x00, 0x53, 0x49, };
+        uint32_t h = 0;
+        sscanf(m_serial.c_str() + 3, "%x", &h);
+        sg_put_unaligned_be32(h, p + 12);
+        resp.assign(p, p + sizeof(p));
+      }
+      else
+        ok = false;
+      break;
+
+    case MODE_SENSE_6:
+      if ((cdb[2] & 0x3f) == INFORMATIONAL_EXCEPTIONS_CONTROL_PAGE) {
+        bool changeable = ((cdb[2] >> 6) == MPAGE_CONTROL_CHANGEABLE);
+        unsigned char p[16] = { 15, 0, 0, 0, INFORMATIONAL_EXCEPTIONS_CONTROL_PAGE, 0x0a, };
+        if (!changeable) {
+          p[6] = 0x10; // EWASC
+          p[7] = 0x06; // MRIE
+        }
+        resp.assign(p, p + sizeof(p));
+      }
+      else
+        ok = false;
+      break;
+
+    case LOG_SENSE:
+      ok = (!cdb[3] && get_log_page(cdb[2] & 0x3f, resp));
+      if (ok && (cdb[2] & 0x3f) == IE_LPAGE)
+        next_cycle();
+      break;
+
+    case REQUEST_SENSE:
+      resp.assign(18, 0);
+      resp[0] = 0x70; resp[7] = 10;
+      if (m_failing) {
+        resp[2] = 0x01; // RECOVERED ERROR
+        resp[12] = SCSI_ASC_IMPENDING_FAILURE;
+      }
+      break;
+
+    case READ_CAPACITY_10:
+      resp.assign(8, 0);
+      sg_put_unaligned_be32(0xffffffff, &resp[0]);
+      sg_put_unaligned_be32(512, &resp[4]);
+      break;
+
+    case SERVICE_ACTION_IN_16:
+      if ((cdb[1] & 0x1f) == SAI_READ_CAPACITY_16) {
+        resp.assign(32, 0);
+        sg_put_unaligned_be64(num_sectors - 1, &resp[0]);
+        sg_put_unaligned_be32(512, &resp[8]);
+      }
+      else
+        ok = false;
+      break;
+
+    default:
+      ok = false;
+  }
+
+  if (!ok) {
+    // CHECK CONDITION, ILLEGAL REQUEST
+    unsigned char sense[18] = { 0x70, 0, SCSI_SK_ILLEGAL_REQUEST, 0, 0, 0, 0, 10, };
+    sense[12] = SCSI_ASC_INVALID_FIELD;
+    iop->scsi_status = SCSI_STATUS_CHECK_CONDITION;
+    if (iop->sensep) {
+      unsigned n = (sizeof(sense) < iop->max_sense_len ? sizeof(sense) : iop->max_sense_len);
+      memcpy(iop->sensep, sense, n);
+      iop->resp_sense_len = n;
+    }
+    if (iop->dxfer_dir == DXFER_FROM_DEVICE)
+      iop->resid = iop->dxfer_len;
+    return true;
+  }
+
+  if (iop->dxfer_dir == DXFER_FROM_DEVICE) {
+    copy_response(iop->dxferp, iop->dxfer_len, resp.data(), resp.size());
+    if (resp.size() < iop->dxfer_len)
+      iop->resid = iop->dxfer_len - resp.size();
+  }
+  return true;
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// sim_nvme_device
+
+class sim_nvme_device
+: public nvme_device,
+  public sim_device_base
+{
+public:
+  sim_nvme_device(smart_interface * intf, const char * dev_name, const char * type)
+    : smart_device(intf, dev_name, "sim", type),
+      nvme_device(1),
+      sim_device_base(type)
+    { }
+
+  virtual bool nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out) override;
+
+private:
+  bool get_log_page(unsigned char lid, std::vector<unsigned char> & resp);
+};
+
+using namespace smartmontools;
+
+bool sim_nvme_device::get_log_page(unsigned char lid, std::vector<unsigned char> & resp)
+{
+  switch (lid) {
+    case 0x01: // Error information
+      resp.assign(64 * sizeof(nvme_error_log_page), 0);
+      if (m_errors)
+        sg_put_unaligned_le64(m_errors, &resp[offsetof(nvme_error_log_page, error_count)]);
+      return true;
+
+    case 0x02: // SMART / Health information
+      next_cycle();
+      resp.assign(sizeof(nvme_smart_log), 0);
+      resp[offsetof(nvme_smart_log, critical_warning)] = (m_failing ? 0x04 : 0x00);
+      sg_put_unaligned_le16(273 + temperature(), &resp[offsetof(nvme_smart_log, temperature)]);
+      resp[offsetof(nvme_smart_log, avail_spare)] = 100;
+      resp[offsetof(nvme_smart_log, spare_thresh)] = 10;
+      resp[offsetof(nvme_smart_log, percent_used)] = (unsigned char)(m_realloc < 100 ? m_realloc : 100);
+      sg_put_unaligned_le64(10, &resp[offsetof(nvme_smart_log, power_cycles)]);
+      sg_put_unaligned_le64(m_hours, &resp[offsetof(nvme_smart_log, power_on_hours)]);
+      sg_put_unaligned_le64(m_realloc, &resp[offsetof(nvme_smart_log, media_errors)]);
+      sg_put_unaligned_le64(m_errors, &resp[offsetof(nvme_smart_log, num_err_log_entries)]);
+      return true;
+
+    case 0x06: // Self-test
+      resp.assign(sizeof(nvme_self_test_log), 0);
+      for (unsigned i = 0; i < 20; i++) {
+        unsigned char * r = &resp[offsetof(nvme_self_test_log, results) + i * sizeof(nvme_self_test_result)];
+        if (i >= m_selftests.size()) {
+          r[0] = 0x0f; // Entry not used
+          continue;
+        }
+        r[0] = (unsigned char)((m_selftests[i].type << 4) | m_selftests[i].status);
+        sg_put_unaligned_le64(m_selftests[i].hours, r + offsetof(nvme_self_test_result, power_on_hours));
+      }
+      return true;
+  }
+  return false;
+}
+
+bool sim_nvme_device::nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out & out)
+{
+  if (!begin_command())
+    return false;
+
+  std::vector<unsigned char> resp;
+  unsigned offset = 0;
+  switch (in.opcode) {
+    case nvme_admin_identify:
+      resp.assign(4096, 0);
+      if ((in.cdw10 & 0xff) == 0x01) {
+        // Identify controller
+        sg_put_unaligned_le16(0x1234, &resp[offsetof(nvme_id_ctrl, vid)]);
+        put_string(&resp[offsetof(nvme_id_ctrl, sn)], m_serial.c_str(), 20);
+        put_string(&resp[offsetof(nvme_id_ctrl, mn)], "SIMULATED NVME SSD", 40);
+        put_string(&resp[offsetof(nvme_id_ctrl, fr)], "SIM1.0", 8);
+        sg_put_unaligned_le32(0x10400, &resp[offsetof(nvme_id_ctrl, ver)]);
+        sg_put_unaligned_le16(0x0010, &resp[offsetof(nvme_id_ctrl, oacs)]); // Self-test
+        resp[offsetof(nvme_id_ctrl, elpe)] = 63;
+        sg_put_unaligned_le16(343, &resp[offsetof(nvme_id_ctrl, wctemp)]);
+        sg_put_unaligned_le16(353, &resp[offsetof(nvme_id_ctrl, cctemp)]);
+        sg_put_unaligned_le64(num_sectors * 512, &resp[offsetof(nvme_id_ctrl, tnvmcap)]);
+        sg_put_unaligned_le32(1, &resp[offsetof(nvme_id_ctrl, nn)]);
+        sg_put_unaligned_le16(500, &resp[offsetof(nvme_id_ctrl, psd)]);
+      }
+      else if ((in.cdw10 & 0xff) == 0x00 && in.nsid == 1) {
+        // Identify namespace
+        sg_put_unaligned_le64(num_sectors, &resp[offsetof(nvme_id_ns, nsze)]);
+        sg_put_unaligned_le64(num_sectors, &resp[offsetof(nvme_id_ns, ncap)]);
+        sg_put_unaligned_le64(num_sectors, &resp[offsetof(nvme_id_ns, nuse)]);
+        resp[offsetof(nvme_id_ns, lbaf) + offsetof(nvme_lbaf, ds)] = 9;
+      }
+      else
+        return set_nvme_err(out, 0x002); // Invalid Field in Command
+      break;
+
+    case nvme_admin_get_log_page:
+      if (!get_log_page(in.cdw10 & 0xff, resp))
+        return set_nvme_err(out, 0x109); // Invalid Log Page
+      offset = in.cdw12;
+      break;
+
+    case nvme_admin_dev_self_test:
+      if ((in.cdw10 & 0xf) == 0x1 || (in.cdw10 & 0xf) == 0x2)
+        add_selftest(in.cdw10 & 0xf, (m_failing ? 0x7 : 0x0));
+      return true;
+
+    default:
+      return set_nvme_err(out, 0x001); // Invalid Command Opcode
+  }
+
+  if (offset > resp.size())
+    offset = resp.size();
+  copy_response(in.buffer, in.size, resp.data() + offset, resp.size() - offset);
+  return true;
+}
+
+} // namespace sim
+
+const sim_device_stats & get_sim_device_stats()
+{
+  return sim::stats;
+}
+
+smart_device * smart_interface::get_sim_device(const char * name, const char * type)
+{
+  // Find protocol argument, default is ATA
+  std::string args = std::string(type + 3) + ',';
+  sim::sim_device_base * simdev;
+  smart_device * dev;
+  if (args.find(",scsi,") != std::string::npos) {
+    sim::sim_scsi_device * d = new sim::sim_scsi_device(this, name, type);
+    simdev = d; dev = d;
+  }
+  else if (args.find(",nvme,") != std::string::npos) {
+    sim::sim_nvme_device * d = new sim::sim_nvme_device(this, name, type);
+    simdev = d; dev = d;
+  }
+  else {
+    sim::sim_ata_device * d = new sim::sim_ata_device(this, name, type);
+    simdev = d; dev = d;
+  }
+
+  std::string errmsg;
+  if (!simdev->check_type(errmsg)) {
+    delete dev;
+    return set_err_np(EINVAL, "Type '%s': %s", type, errmsg.c_str());
+  }
+  return dev;
+}
@@ -0,0 +1,31 @@
+/*
+ * dev_sim.h
+ *
+ * Home page of code is: https://www.smartmontools.org
+ *
+ * Copyright (C) 2026 smartmontools developers
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef DEV_SIM_H
+#define DEV_SIM_H
+
+#define DEV_SIM_H_CVSID "$Id$"
+
+#include <stdint.h>
+
+/// Command statistics of all simulated devices ('-d sim,...').
+struct sim_device_stats
+{
+  unsigned devices;  ///< Number of devices created
+  uint64_t commands; ///< Number of pass-through commands
+  uint64_t failures; ///< Number of injected failures
+  uint64_t hangs;    ///< Number of injected hangs
+  uint64_t delay_usec; ///< Total injected latency and hang time
+};
+
+/// Get statistics of all simulated devices.
+const sim_device_stats & get_sim_device_stats();
+
+#endif // DEV_SIM_H
@@ -39,6 +39,8 @@ public:
 
   virtual void release(const smart_device * dev) override;
 
+  virtual void set_timeout(unsigned seconds) override;
+
 private:
   smart_device * m_tunnel_base_dev;
 };
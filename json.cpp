@@ -19,7 +19,10 @@ const char * json_cvsid = "$Id$"
 #include "sg_unaligned.h"
 #include "utility.h" // regular_expression, uint128_*()
 
+#include <errno.h>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdexcept>
 
 static void jassert_failed(int line, const char * expr)
@@ -253,6 +256,34 @@ void json::ref::operator+=(std::initializer_list<initlist_value> ilist)
     operator[](i++) = v;
 }
 
+bool json::ref::set_from_json(const char * text)
+{
+  if (!m_js.m_enabled)
+    return true;
+  // Parse into temporary tree first to leave element unchanged on error
+  json tmp;
+  tmp.enable();
+  node_path path;
+  const char * s = text;
+  if (!tmp.parse_value(s, path, 0))
+    return false;
+  while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+    s++;
+  if (*s)
+    return false;
+
+  // Move parsed tree to element
+  node & src = tmp.m_root_node;
+  node * p = m_js.find_or_create_node(m_path, src.type);
+  p->intval = src.intval; p->intval_hi = src.intval_hi;
+  p->strval.swap(src.strval);
+  p->childs.swap(src.childs);
+  p->key2index.swap(src.key2index);
+  if (tmp.m_uint128_output)
+    m_js.m_uint128_output = true;
+  return true;
+}
+
 json::node::node()
 {
 }
@@ -304,6 +335,14 @@ const json::node * json::node::const_iterator::operator*() const
     return m_node_p->childs[m_child_idx].get();
 }
 
+void json::clear()
+{
+  m_root_node.childs.clear();
+  m_root_node.key2index.clear();
+  m_root_node.type = nt_unset;
+  m_enabled = m_verbose = m_uint128_output = false;
+}
+
 json::node * json::find_or_create_node(const json::node_path & path, node_type type)
 {
   node * p = &m_root_node;
@@ -421,6 +460,174 @@ void json::set_initlist_value(const node_path & path, const initlist_value & val
   }
 }
 
+// Append UTF-8 sequence of Unicode code point to string
+static void append_utf8(std::string & str, unsigned cp)
+{
+  if (cp < 0x80)
+    str += (char)cp;
+  else if (cp < 0x800) {
+    str += (char)(0xc0 | (cp >> 6));
+    str += (char)(0x80 | (cp & 0x3f));
+  }
+  else {
+    str += (char)(0xe0 | (cp >> 12));
+    str += (char)(0x80 | ((cp >> 6) & 0x3f));
+    str += (char)(0x80 | (cp & 0x3f));
+  }
+}
+
+// Parse quoted string, 's' points to opening quote
+static bool parse_quoted_string(const char * & s, std::string & str)
+{
+  str.clear();
+  for (s++; *s != '"'; s++) {
+    char c = *s;
+    if (!c || c == '\n')
+      return false;
+    if (c == '\\') {
+      switch (*++s) {
+        case '"': case '\\': case '/': c = *s; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u': {
+            unsigned cp = 0;
+            for (int i = 0; i < 4; i++) {
+              char h = *++s;
+              if      ('0' <= h && h <= '9') cp = (cp << 4) | (h - '0');
+              else if ('a' <= h && h <= 'f') cp = (cp << 4) | (h - 'a' + 10);
+              else if ('A' <= h && h <= 'F') cp = (cp << 4) | (h - 'A' + 10);
+              else return false;
+            }
+            append_utf8(str, cp); // Limit: surrogate pairs not supported
+          }
+          continue;
+        default: return false;
+      }
+    }
+    str += c;
+  }
+  s++;
+  return true;
+}
+
+// Parse JSON value at 's' and create element at 'path'.
+// Limit: floating point numbers are not supported.
+bool json::parse_value(const char * & s, node_path & path, int level)
+{
+  if (level > 100)
+    return false;
+  while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+    s++;
+
+  switch (*s) {
+    case '{': case '[': {
+        bool is_obj = (*s == '{');
+        char end = (is_obj ? '}' : ']');
+        node * p = find_or_create_node(path, (is_obj ? nt_object : nt_array));
+        int index = 0;
+        for (s++; ; ) {
+          while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+            s++;
+          if (*s == end && !index)
+            break; // empty
+          node_info ni;
+          if (is_obj) {
+            if (*s != '"' || !parse_quoted_string(s, ni.key) || ni.key.empty())
+              return false;
+            while (*s == ' ' || *s == '\t')
+              s++;
+            if (*s++ != ':')
+              return false;
+          }
+          else
+            ni.index = index;
+          path.push_back(ni);
+          bool ok = parse_value(s, path, level + 1);
+          path.pop_back();
+          if (!ok)
+            return false;
+          index++;
+          while (*s == ' ' || *s == '\t' || *s == '\n' || *s == '\r')
+            s++;
+          if (*s == end)
+            break;
+          if (*s++ != ',')
+            return false;
+        }
+        s++;
+        // Keep trailing 'null' elements of sparse array
+        if (!is_obj && p->childs.size() < (unsigned)index)
+          p->childs.resize(index);
+      }
+      return true;
+
+    case '"': {
+        std::string str;
+        if (!parse_quoted_string(s, str))
+          return false;
+        set_string(path, str);
+      }
+      return true;
+
+    case 't': case 'f': {
+        bool val = (*s == 't');
+        const char * word = (val ? "true" : "false");
+        size_t len = strlen(word);
+        if (strncmp(s, word, len))
+          return false;
+        s += len;
+        set_bool(path, val);
+      }
+      return true;
+
+    case 'n':
+      // Unset element of sparse array
+      if (strncmp(s, "null", 4) || path.empty() || !path.back().key.empty())
+        return false;
+      s += 4;
+      return true;
+
+    case '-': {
+        char * end = nullptr;
+        errno = 0;
+        long long val = strtoll(s, &end, 10);
+        if (end == s || errno || *end == '.' || *end == 'e' || *end == 'E')
+          return false;
+        s = end;
+        set_int64(path, val);
+      }
+      return true;
+
+    default: {
+        if (!('0' <= *s && *s <= '9'))
+          return false;
+        // Unsigned decimal, up to 128 bit
+        uint64_t hi = 0, lo = 0;
+        for ( ; '0' <= *s && *s <= '9'; s++) {
+          // hi:lo = hi:lo * 10 + digit, fail if >= 2^128
+          uint64_t lo8 = lo << 3, lo2 = lo << 1, d = *s - '0';
+          uint64_t sum = lo8 + lo2, lo10 = sum + d;
+          uint64_t carry = (lo >> 61) + (lo >> 63) + (sum < lo8) + (lo10 < sum);
+          if (hi > UINT64_MAX / 10 || hi * 10 > UINT64_MAX - carry)
+            return false;
+          hi = hi * 10 + carry; lo = lo10;
+        }
+        if (*s == '.' || *s == 'e' || *s == 'E')
+          return false;
+        if (!hi)
+          set_uint64(path, lo);
+        else {
+          m_uint128_output = true;
+          set_uint128(path, hi, lo);
+        }
+      }
+      return true;
+  }
+}
+
 // Return -1 if all UTF-8 sequences are valid, else return index of first invalid char
 static int check_utf8(const char * s)
 {
@@ -152,6 +152,10 @@ public:
     /// Braced-init-list support for simple arrays.
     void operator+=(std::initializer_list<initlist_value> ilist);
 
+    /// Parse JSON text (e.g. output of print()) and create element.
+    /// Return false on syntax error.
+    bool set_from_json(const char * text);
+
   private:
     friend class json;
     explicit ref(json & js);
@@ -187,10 +191,17 @@ public:
   bool is_enabled() const
     { return m_enabled; }
 
+  /// Remove all elements and reset to initial (disabled) state.
+  void clear();
+
   /// Enable/disable extra string output for safe integers also.
   void set_verbose(bool yes = true)
     { m_verbose = yes; }
 
+  /// Return true if extra string output is enabled.
+  bool is_verbose() const
+    { return m_verbose; }
+
   /// Return true if any 128-bit value has been output.
   bool has_uint128_output() const
     { return m_uint128_output; }
@@ -257,6 +268,8 @@ private:
   void set_string(const node_path & path, const std::string & value);
   void set_initlist_value(const node_path & path, const initlist_value & value);
 
+  bool parse_value(const char * & s, node_path & path, int level);
+
   static void print_json(FILE * f, bool pretty, bool sorted, const node * p, int level);
   static void print_yaml(FILE * f, bool pretty, bool sorted, const node * p, int level_o,
                          int level_a, bool cont);
@@ -23,7 +23,9 @@
 #include <io.h> // access()
 #endif
 
+#include <algorithm>
 #include <stdexcept>
+#include <unordered_map>
 
 const char * knowndrives_cpp_cvsid = "$Id$"
                                      KNOWNDRIVES_H_CVSID;
@@ -72,7 +74,38 @@ public:
 
   /// Append builtin table.
   void append(const drive_settings * builtin_tab, unsigned builtin_size)
-    { m_builtin_tab = builtin_tab; m_builtin_size = builtin_size; }
+    { m_builtin_tab = builtin_tab; m_builtin_size = builtin_size;
+      invalidate(); }
+
+  /// Get indexes of USB entries matching vendor:product ID in table order.
+  void find_usb_entries(int vendor_id, int product_id, std::vector<unsigned> & entries);
+
+  /// Parsed presets of an entry, shared by all drives using the entry.
+  struct parsed_presets
+  {
+    ata_vendor_attr_defs defs;
+    firmwarebug_defs firmwarebugs;
+    bool ok;
+  };
+
+  /// Get parsed presets of entry, parse on first use.
+  const parsed_presets & get_presets(const drive_settings * dbentry);
+
+  /// Cached result of a drive lookup.
+  struct lookup_result
+  {
+    const drive_settings * dbentry;
+    std::string dbversion;
+  };
+
+  /// Get cached result for model and firmware, nullptr if none.
+  const lookup_result * find_lookup(const std::string & key) const
+    { auto it = m_lookup_cache.find(key);
+      return (it != m_lookup_cache.end() ? &it->second : nullptr); }
+
+  /// Add result to lookup cache.
+  void add_lookup(const std::string & key, const lookup_result & result)
+    { m_lookup_cache[key] = result; }
 
 private:
   const drive_settings * m_builtin_tab;
@@ -83,12 +116,33 @@ private:
 
   const char * copy_string(const char * str);
 
+  // Index of USB entries, built on first use.
+  bool m_usb_index_valid;
+  std::unordered_map<unsigned, std::vector<unsigned> > m_usb_ids; // vendor<<16|product -> entries
+  std::unordered_map<unsigned, std::vector<unsigned> > m_usb_vendors; // vendor -> entries for any product
+  struct usb_regex_entry {
+    unsigned index;
+    regular_expression regex;
+  };
+  std::vector<usb_regex_entry> m_usb_regex; // Entries not expanded
+
+  void build_usb_index();
+
+  // Presets and lookup results, computed on first use.
+  std::unordered_map<const drive_settings *, parsed_presets> m_presets_cache;
+  std::unordered_map<std::string, lookup_result> m_lookup_cache;
+
+  void invalidate()
+    { m_usb_index_valid = false;
+      m_presets_cache.clear(); m_lookup_cache.clear(); }
+
   drive_database(const drive_database &);
   void operator=(const drive_database &);
 };
 
 drive_database::drive_database()
-: m_builtin_tab(0), m_builtin_size(0)
+: m_builtin_tab(0), m_builtin_size(0),
+  m_usb_index_valid(false)
 {
 }
 
@@ -113,6 +167,7 @@ void drive_database::push_back(const drive_settings & src)
   dest.warningmsg     = copy_string(src.warningmsg);
   dest.presets        = copy_string(src.presets);
   m_custom_tab.push_back(dest);
+  invalidate();
 }
 
 const char * drive_database::copy_string(const char * src)
@@ -197,18 +252,158 @@ static bool match(const char * pattern, const char * str)
   return regex.full_match(str);
 }
 
+// Expand a regular expression which consists only of literals, '.',
+// character classes and groups of alternatives into the list of all
+// matching strings.  Return false if the expression uses other syntax or
+// matches more than MAX strings.  '.' matches hex digits only.
+static bool expand_id_regex(const char * & p, std::vector<std::string> & result, unsigned max)
+{
+  std::vector<std::string> alt(1), all;
+  for (;;) {
+    std::vector<std::string> next;
+    char c = *p;
+    if (!c || c == '|' || c == ')') {
+      // End of alternative
+      all.insert(all.end(), alt.begin(), alt.end());
+      if (all.size() > max)
+        return false;
+      if (c != '|')
+        break;
+      p++;
+      alt.assign(1, std::string());
+      continue;
+    }
+
+    std::vector<std::string> items;
+    if (c == '(') {
+      p++;
+      if (!expand_id_regex(p, items, max) || *p != ')')
+        return false;
+      p++;
+    }
+    else if (c == '[') {
+      for (p++; *p != ']'; p++) {
+        if (!*p || *p == '^' || *p == '\\' || *p == '[')
+          return false;
+        int first = (unsigned char)*p, last = first;
+        if (p[1] == '-' && p[2] && p[2] != ']') {
+          last = (unsigned char)p[2]; p += 2;
+        }
+        for (int ci = first; ci <= last; ci++)
+          items.push_back(std::string(1, (char)ci));
+      }
+      p++;
+    }
+    else if (c == '.') {
+      for (const char * h = "0123456789abcdef"; *h; h++)
+        items.push_back(std::string(1, *h));
+      p++;
+    }
+    else if (isalnum((unsigned char)c) || c == ':') {
+      items.push_back(std::string(1, c));
+      p++;
+    }
+    else
+      return false;
+
+    if (alt.size() * items.size() > max)
+      return false;
+    for (const auto & a : alt)
+      for (const auto & i : items)
+        next.push_back(a + i);
+    alt.swap(next);
+  }
+  result.swap(all);
+  return true;
+}
+
+// Parse "0xVVVV" or "0xVVVV:0xPPPP" in lower case.
+static bool parse_usb_id(const std::string & str, unsigned & id)
+{
+  static const regular_expression regex("0x[0-9a-f]{4}(:0x[0-9a-f]{4})?");
+  if (!regex.full_match(str.c_str()))
+    return false;
+  unsigned v = 0, p = 0;
+  sscanf(str.c_str(), "0x%x:0x%x", &v, &p);
+  id = (str.size() > 6 ? v << 16 | p : v);
+  return true;
+}
+
+// Add all USB entries to index.  Vendor:product regular expressions are
+// expanded into individual IDs if possible.  Regular expressions which
+// expand to too many IDs remain to be matched.
+void drive_database::build_usb_index()
+{
+  m_usb_ids.clear(); m_usb_vendors.clear(); m_usb_regex.clear();
+  for (unsigned i = 0; i < size(); i++) {
+    const char * pattern = (*this)[i].modelregexp;
+    if (get_dbentry_type(&(*this)[i]) != DBENTRY_USB)
+      continue;
+
+    // "0xVVVV:0x...." matches any product of this vendor
+    std::vector<std::string> ids;
+    std::string vendor(pattern);
+    bool any_product = (vendor.size() > 7 && !vendor.compare(vendor.size() - 7, 7, ":0x...."));
+    if (any_product)
+      vendor.erase(vendor.size() - 7);
+    const char * p = vendor.c_str();
+    bool ok = (expand_id_regex(p, ids, 256) && !*p);
+    for (unsigned j = 0; ok && j < ids.size(); j++) {
+      unsigned id;
+      if (!(parse_usb_id(ids[j], id) && (any_product ? id <= 0xffff : id > 0xffff)))
+        ok = false;
+    }
+
+    if (!ok) {
+      usb_regex_entry e;
+      e.index = i;
+      if (!compile(e.regex, pattern))
+        continue;
+      m_usb_regex.push_back(e);
+      continue;
+    }
+    for (const auto & s : ids) {
+      unsigned id; parse_usb_id(s, id);
+      std::vector<unsigned> & v = (any_product ? m_usb_vendors[id] : m_usb_ids[id]);
+      if (v.empty() || v.back() != i)
+        v.push_back(i);
+    }
+  }
+  m_usb_index_valid = true;
+}
+
+void drive_database::find_usb_entries(int vendor_id, int product_id, std::vector<unsigned> & entries)
+{
+  if (!m_usb_index_valid)
+    build_usb_index();
+
+  entries.clear();
+  unsigned id = (vendor_id & 0xffff) << 16 | (product_id & 0xffff);
+  auto it = m_usb_ids.find(id);
+  if (it != m_usb_ids.end())
+    entries = it->second;
+  it = m_usb_vendors.find(id >> 16);
+  if (it != m_usb_vendors.end())
+    entries.insert(entries.end(), it->second.begin(), it->second.end());
+
+  if (!m_usb_regex.empty()) {
+    char usb_id_str[16];
+    snprintf(usb_id_str, sizeof(usb_id_str), "0x%04x:0x%04x", vendor_id, product_id);
+    for (const auto & e : m_usb_regex) {
+      if (e.regex.full_match(usb_id_str))
+        entries.push_back(e.index);
+    }
+  }
+  std::sort(entries.begin(), entries.end());
+}
+
 // Searches knowndrives[] for a drive with the given model number and firmware
 // string.  If either the drive's model or firmware strings are not set by the
 // manufacturer then values of NULL may be used.  Returns the entry of the
 // first match in knowndrives[] or 0 if no match if found.
-static const drive_settings * lookup_drive(const char * model, const char * firmware,
-  std::string * dbversion = nullptr)
+static const drive_settings * lookup_drive_uncached(const char * model, const char * firmware,
+  std::string * dbversion)
 {
-  if (!model)
-    model = "";
-  if (!firmware)
-    firmware = "";
-
   for (unsigned i = 0; i < knowndrives.size(); i++) {
     dbentry_type t = get_dbentry_type(&knowndrives[i]);
     // Get version if requested
@@ -239,6 +434,28 @@ static const drive_settings * lookup_drive(const char * model, const char * firm
   return 0;
 }
 
+// Same as above, results are cached for drives with same model and firmware.
+static const drive_settings * lookup_drive(const char * model, const char * firmware,
+  std::string * dbversion = nullptr)
+{
+  if (!model)
+    model = "";
+  if (!firmware)
+    firmware = "";
+
+  std::string key = model; key += '\n'; key += firmware;
+  const drive_database::lookup_result * cached = knowndrives.find_lookup(key);
+  if (!cached) {
+    drive_database::lookup_result result;
+    result.dbentry = lookup_drive_uncached(model, firmware, &result.dbversion);
+    knowndrives.add_lookup(key, result);
+    cached = knowndrives.find_lookup(key);
+  }
+  if (dbversion && !cached->dbversion.empty())
+    *dbversion = cached->dbversion;
+  return cached->dbentry;
+}
+
 
 // Parse drive or USB options in preset string, return false on error.
 static bool parse_db_presets(const char * presets, ata_vendor_attr_defs * defs,
@@ -291,6 +508,36 @@ static inline bool parse_presets(const char * presets,
   return parse_db_presets(presets, &defs, &firmwarebugs, 0);
 }
 
+const drive_database::parsed_presets & drive_database::get_presets(const drive_settings * dbentry)
+{
+  auto it = m_presets_cache.find(dbentry);
+  if (it != m_presets_cache.end())
+    return it->second;
+  parsed_presets & p = m_presets_cache[dbentry];
+  p.ok = parse_presets(dbentry->presets, p.defs, p.firmwarebugs);
+  return p;
+}
+
+// Apply parsed presets to defs and firmwarebugs.  Values that have
+// already been set by the user will not be changed.  The shared defs
+// are only copied if the user set any values.
+static void apply_presets(const drive_database::parsed_presets & presets,
+                          ata_vendor_attr_defs & defs, firmwarebug_defs & firmwarebugs)
+{
+  if (defs.empty())
+    defs = presets.defs;
+  else {
+    const ata_vendor_attr_defs & cdefs = defs;
+    for (int i = 0; i < MAX_ATTRIBUTE_NUM; i++) {
+      if (presets.defs[i].priority == PRIOR_DATABASE && cdefs[i].priority < PRIOR_USER)
+        defs[i] = presets.defs[i];
+    }
+  }
+  // Don't set if user specified '-F none'.
+  if (!firmwarebugs.is_set(BUG_NONE))
+    firmwarebugs.set(presets.firmwarebugs);
+}
+
 // Parse '-d' option in preset string, return false on error.
 static inline bool parse_usb_type(const char * presets, std::string & type)
 {
@@ -314,26 +561,21 @@ static void parse_usb_names(const char * names, usb_dev_info & info)
 int lookup_usb_device(int vendor_id, int product_id, int bcd_device,
                       usb_dev_info & info, usb_dev_info & info2)
 {
-  // Format strings to match
-  char usb_id_str[16], bcd_dev_str[16];
-  snprintf(usb_id_str, sizeof(usb_id_str), "0x%04x:0x%04x", vendor_id, product_id);
+  // Format string to match
+  char bcd_dev_str[16];
   if (bcd_device >= 0)
     snprintf(bcd_dev_str, sizeof(bcd_dev_str), "0x%04x", bcd_device);
   else
     bcd_dev_str[0] = 0;
 
+  // Get entries with matching USB vendor:product ID
+  std::vector<unsigned> entries;
+  knowndrives.find_usb_entries(vendor_id, product_id, entries);
+
   int found = 0;
-  for (unsigned i = 0; i < knowndrives.size(); i++) {
+  for (unsigned i : entries) {
     const drive_settings & dbentry = knowndrives[i];
 
-    // Skip drive entries
-    if (get_dbentry_type(&dbentry) != DBENTRY_USB)
-      continue;
-
-    // Check whether USB vendor:product ID matches
-    if (!match(dbentry.modelregexp, usb_id_str))
-      continue;
-
     // Parse '-d type'
     usb_dev_info d;
     if (!parse_usb_type(dbentry.presets, d.usb_type))
@@ -597,8 +839,10 @@ const drive_settings * lookup_drive_apply_presets(
 
   if (*dbentry->presets) {
     // Apply presets
-    if (!parse_presets(dbentry->presets, defs, firmwarebugs))
+    const drive_database::parsed_presets & presets = knowndrives.get_presets(dbentry);
+    if (!presets.ok)
       pout("Syntax error in preset option string \"%s\"\n", dbentry->presets);
+    apply_presets(presets, defs, firmwarebugs);
   }
   return dbentry;
 }
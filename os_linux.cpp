@@ -2738,7 +2738,8 @@ bool linux_nvme_device::nvme_pass_through(const nvme_cmd_in & in, nvme_cmd_out &
   pt.cdw14 = in.cdw14;
   pt.cdw15 = in.cdw15;
   // Kernel default for NVMe admin commands is 60 seconds
-  // pt.timeout_ms = 60 * 1000;
+  if (get_timeout())
+    pt.timeout_ms = get_timeout() * 1000;
 
   int status = ioctl(get_fd(), NVME_IOCTL_ADMIN_CMD, &pt);
 
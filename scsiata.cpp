@@ -378,7 +378,7 @@ bool sat_device::ata_pass_through(const ata_cmd_in & in, ata_cmd_out & out)
     io_hdr.cmnd_len = passthru_size;
     io_hdr.sensep = sense;
     io_hdr.max_sense_len = sizeof(sense);
-    io_hdr.timeout = SCSI_TIMEOUT_DEFAULT;
+    io_hdr.timeout = (get_timeout() ? get_timeout() : SCSI_TIMEOUT_DEFAULT);
 
     scsi_device * scsidev = get_tunnel_dev();
     if (!scsidev->scsi_pass_through(&io_hdr)) {
@@ -198,17 +198,122 @@ scsi_device::cmd_support_level(uint8_t opcode, bool sa_valid,
     return scs;
 }
 
+bool
+scsi_page_support::is_log_page_supported(int page, int subpage) const
+{
+    if (!subpage)
+        return !!((m_log_pages[(page >> 5) & 0x1] >> (page & 0x1f)) & 1);
+    unsigned short ps = (unsigned short)((page & 0x3f) << 8 | (subpage & 0xff));
+    for (unsigned short p : m_log_list) {
+        if (p == ps)
+            return true;
+    }
+    return false;
+}
+
+void
+scsi_page_support::add_log_page(int page, int subpage)
+{
+    if (is_log_page_supported(page, subpage))
+        return;
+    if (!subpage)
+        m_log_pages[(page >> 5) & 0x1] |= 1U << (page & 0x1f);
+    m_log_list.push_back((unsigned short)((page & 0x3f) << 8 | (subpage & 0xff)));
+}
+
+void
+scsi_page_support::clear_log_pages()
+{
+    m_log_known = 0;
+    m_log_pages[0] = m_log_pages[1] = 0;
+    m_log_list.clear();
+}
+
+int
+scsi_page_support::get_log_resp_len(int page, int subpage) const
+{
+    unsigned ps = (unsigned)((page & 0x3f) << 24 | (subpage & 0xff) << 16);
+    for (unsigned r : m_resp_lens) {
+        if ((r & 0xffff0000) == ps)
+            return (int)(r & 0xffff);
+    }
+    return 0;
+}
+
+void
+scsi_page_support::set_log_resp_len(int page, int subpage, int len)
+{
+    unsigned ps = (unsigned)((page & 0x3f) << 24 | (subpage & 0xff) << 16);
+    for (unsigned & r : m_resp_lens) {
+        if ((r & 0xffff0000) == ps) {
+            r = ps | (len & 0xffff);
+            return;
+        }
+    }
+    m_resp_lens.push_back(ps | (len & 0xffff));
+}
+
+scsi_log_cache::scsi_log_cache(scsi_device * device)
+: m_device(device)
+{
+    if (m_device)
+        m_device->set_log_cache(this);
+}
+
+scsi_log_cache::~scsi_log_cache()
+{
+    if (m_device && m_device->get_log_cache() == this)
+        m_device->set_log_cache(nullptr);
+}
+
+bool
+scsi_log_cache::get(int pagenum, int subpagenum, uint8_t * pBuf, int len) const
+{
+    auto it = m_pages.find((pagenum & 0x3f) << 8 | (subpagenum & 0xff));
+    if (it == m_pages.end())
+        return false;
+    const std::vector<uint8_t> & resp = it->second;
+    int n = (int)resp.size();
+    if (n < len && n < (int)sg_get_unaligned_be16(resp.data() + 2) + 4)
+        return false; /* truncated, fetch again */
+    memcpy(pBuf, resp.data(), (n < len ? n : len));
+    return true;
+}
+
+void
+scsi_log_cache::add(int pagenum, int subpagenum, const uint8_t * pBuf, int len)
+{
+    if (len < 4)
+        return;
+    m_pages[(pagenum & 0x3f) << 8 | (subpagenum & 0xff)].assign(pBuf, pBuf + len);
+}
+
+/* Uses Supported VPD pages from device->page_support() if already known,
+ * otherwise fetches them and saves them there. */
 supported_vpd_pages::supported_vpd_pages(scsi_device * device) : num_valid(0)
 {
     unsigned char b[0xfc] = {};   /* pre SPC-3 INQUIRY max response size */
 
-    if (device && (0 == scsiInquiryVpd(device, SCSI_VPD_SUPPORTED_VPD_PAGES,
-                   b, sizeof(b)))) {
+    if (!device)
+        return;
+    scsi_page_support & ps = device->page_support();
+    if (ps.vpd_pages_known()) {
+        for (int k = 0; k < 256; ++k) {
+            if (ps.is_vpd_page_supported(k))
+                pages[num_valid++] = (unsigned char)k;
+        }
+        return;
+    }
+    if (0 == scsiInquiryVpd(device, SCSI_VPD_SUPPORTED_VPD_PAGES,
+                            b, sizeof(b))) {
         num_valid = sg_get_unaligned_be16(b + 2);
-        int n = sizeof(pages);
+        int n = sizeof(b) - 4;
         if (num_valid > n)
             num_valid = n;
         memcpy(pages, b + 4, num_valid);
+        for (int k = 0; k < num_valid; ++k)
+            ps.add_vpd_page(pages[k]);
+        ps.set_vpd_pages_known();
     }
 }
 
@@ -881,11 +986,29 @@ scsiLogSense(scsi_device * device, int pagenum, int subpagenum, uint8_t *pBuf,
 
     if (known_resp_len > bufLen)
         return -EIO;
+    scsi_log_cache * cache = device->get_log_cache();
+    if (cache && cache->get(pagenum, subpagenum, pBuf,
+                            (known_resp_len > 0 ? known_resp_len : bufLen)))
+        return 0;
     if (known_resp_len > 0)
         pageLen = known_resp_len;
     else if (known_resp_len < 0)
         pageLen = bufLen;
     else {      /* 0 == known_resp_len */
+        /* Use response length from a previous twin fetch if known */
+        scsi_page_support & ps = device->page_support();
+        int prev_len = ps.get_log_resp_len(pagenum, subpagenum);
+        if (0 < prev_len && prev_len <= bufLen) {
+            int res = scsiLogSense(device, pagenum, subpagenum, pBuf, bufLen,
+                                   prev_len);
+            if (res)
+                return res;
+            if (sg_get_unaligned_be16(pBuf + 2) + 4 <= prev_len ||
+                prev_len == bufLen)
+                return 0;
+            /* Response got longer, fall back to twin fetch */
+        }
+
         /* Twin fetch strategy: first fetch to find response length */
         pageLen = 4;
         if (pageLen > bufLen)
@@ -950,6 +1073,92 @@ scsiLogSense(scsi_device * device, int pagenum, int subpagenum, uint8_t *pBuf,
         return SIMPLE_ERR_BAD_RESP;
     if (0 == sg_get_unaligned_be16(pBuf + 2))
         return SIMPLE_ERR_BAD_RESP;
+    /* Remember response length to skip first fetch next time */
+    if (0 == known_resp_len)
+        device->page_support().set_log_resp_len(pagenum, subpagenum, pageLen);
+    if (cache)
+        cache->add(pagenum, subpagenum, pBuf, pageLen);
+    return 0;
+}
+
+/* Fetches supported log pages (and subpages if 'subpages' is set) into
+ * device->page_support() unless already known. Returns 0 if ok, else
+ * SIMPLE_ERR_BAD_OPCODE if LOG SENSE is not supported or error from
+ * scsiLogSense(). */
+int
+scsiReadSupportedLogPages(scsi_device * device, bool subpages)
+{
+    static const int resp_len = 252;
+    static const int resp_long_len = (62 * 256) + 252;
+    static const char * logSenStr = "Log Sense";
+    scsi_page_support & ps = device->page_support();
+    int err;
+
+    if (ps.log_pages_known() && (!subpages || ps.log_subpages_known()))
+        return 0;
+    ps.clear_log_pages();
+
+    if (SC_NO_SUPPORT == device->cmd_support_level(LOG_SENSE, false, 0)) {
+        if (scsi_debugmode > 0)
+            pout("%s: RSOC says %s not supported\n", __func__, logSenStr);
+        return SIMPLE_ERR_BAD_OPCODE;
+    }
+    /* Get supported log pages */
+    uint8_t sup_lpgs[resp_len] = {};
+    if ((err = scsiLogSense(device, SUPPORTED_LPAGES, 0, sup_lpgs,
+                            resp_len, 0 /* do double fetch */))) {
+        if (scsi_debugmode > 0)
+            pout("%s for supported pages failed [%s]\n", logSenStr,
+                 scsiErrString(err));
+        /* try one more time with defined length, workaround for the bug #678
+        found with ST8000NM0075/E001 */
+        err = scsiLogSense(device, SUPPORTED_LPAGES, 0, sup_lpgs,
+                            resp_len, 68); /* 64 max pages + 4b header */
+        if (scsi_debugmode > 0)
+            pout("%s for supported pages failed (second attempt) [%s]\n",
+                 logSenStr, scsiErrString(err));
+        if (err)
+            return err;
+    }
+
+    int len = sup_lpgs[3];
+    for (int k = 0; k < len && LOGPAGEHDRSIZE + k < resp_len; ++k)
+        ps.add_log_page(0x3f & sup_lpgs[LOGPAGEHDRSIZE + k], 0);
+
+    if (subpages &&
+        SC_NO_SUPPORT != device->cmd_support_level(LOG_SENSE, false, 0,
+                                  true /* does it support subpages ? */)) {
+        /* Get supported log pages and subpages. Most drives seems to include
+        the supported log pages here as well, but some drives such as the
+        Samsung PM1643a will only report the additional log pages with
+        subpages here */
+        raw_buffer buf(resp_long_len);
+        uint8_t * b = buf.data();
+        if ((err = scsiLogSense(device, SUPPORTED_LPAGES, SUPP_SPAGE_L_SPAGE,
+                                b, resp_long_len,
+                                -1 /* just single not double fetch */))) {
+            if (scsi_debugmode > 0)
+                pout("%s for supported pages and subpages failed [%s]\n",
+                     logSenStr, scsiErrString(err));
+        } else if (0 == memcmp(b, sup_lpgs, resp_len)) {
+            /* Ensure we didn't get the same answer than without the subpages */
+            if (scsi_debugmode > 0)
+                pout("%s: %s response ignored subpage field, bad\n",
+                     __func__, logSenStr);
+        } else if (! ((0x40 & b[0]) && (SUPP_SPAGE_L_SPAGE == b[1]))) {
+            if (scsi_debugmode > 0)
+                pout("%s response supported subpages is bad SPF=%u SUBPG=%u\n",
+                     logSenStr, !! (0x40 & b[0]), b[2]);
+        } else {
+            len = sg_get_unaligned_be16(b + 2);
+            for (int k = 0; k + 1 < len && LOGPAGEHDRSIZE + k + 1 < resp_long_len;
+                 k += 2)
+                ps.add_log_page(0x3f & b[LOGPAGEHDRSIZE + k],
+                                b[LOGPAGEHDRSIZE + k + 1]);
+        }
+    }
+
+    ps.set_log_pages_known(subpages);
     return 0;
 }
 
@@ -967,6 +1176,10 @@ scsiLogSelect(scsi_device * device, int pcr, int sp, int pc, int pagenum,
     uint8_t cdb[10] = {};
     uint8_t sense[32];
 
+    /* Log pages may change */
+    if (device->get_log_cache())
+        device->get_log_cache()->clear();
+
     io_hdr.dxfer_dir = DXFER_TO_DEVICE;
     io_hdr.dxfer_len = bufLen;
     io_hdr.dxferp = pBuf;
@@ -1564,6 +1777,8 @@ scsi_pass_through_yield_sense(scsi_device * device, scsi_cmnd_io * iop,
             dStrHexFp(iop->dxferp, iop->dxfer_len, -1, nullptr);
     }
 
+    if (device->get_timeout() && iop->timeout == SCSI_TIMEOUT_DEFAULT)
+        iop->timeout = device->get_timeout();
     if (! device->scsi_pass_through(iop))
         return false; // this will be missing device, timeout, etc
 
@@ -26,6 +26,9 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <map>
+#include <vector>
+
 /* #define SCSI_DEBUG 1 */ /* Comment out to disable command debugging */
 
 /* Following conditional defines just in case OS already has them defined.
@@ -387,7 +390,8 @@ Documentation, see http://www.storage.ibm.com/techsup/hddtech/prodspecs.htm */
 class scsi_device;
 
 // Set of supported SCSI VPD pages. Constructor fetches Supported VPD pages
-// VPD page and remembers the response for later queries.
+// VPD page unless already known from scsi_device::page_support() and
+// remembers the response for later queries.
 class supported_vpd_pages
 {
 public:
@@ -402,6 +406,35 @@ private:
 
 extern supported_vpd_pages * supported_vpd_pages_p;
 
+// Cache of LOG SENSE responses. While attached to a device, scsiLogSense()
+// returns cached responses and adds new ones, so each page is fetched
+// only once. scsiLogSelect() clears the cache.
+class scsi_log_cache
+{
+public:
+    // Attach to device if nonnull
+    explicit scsi_log_cache(scsi_device * device = nullptr);
+    // Detach from device
+    ~scsi_log_cache();
+
+    // Copy cached response to pBuf, return true if found and at least
+    // 'len' bytes or the complete page are available.
+    bool get(int pagenum, int subpagenum, uint8_t * pBuf, int len) const;
+
+    // Add response.
+    void add(int pagenum, int subpagenum, const uint8_t * pBuf, int len);
+
+    void clear()
+        { m_pages.clear(); }
+
+private:
+    scsi_device * m_device;
+    std::map<int, std::vector<uint8_t> > m_pages;
+
+    scsi_log_cache(const scsi_log_cache &);
+    void operator=(const scsi_log_cache &);
+};
+
 /* This is a heuristic that takes into account the command bytes and length
  * to decide whether the presented unstructured sequence of bytes could be
  * a SCSI command. If so it returns true otherwise false. Vendor specific
@@ -451,6 +484,8 @@ int scsiInquiryVpd(scsi_device * device, int vpd_page, uint8_t *pBuf,
 int scsiLogSense(scsi_device * device, int pagenum, int subpagenum,
                  uint8_t *pBuf, int bufLen, int known_resp_len);
 
+int scsiReadSupportedLogPages(scsi_device * device, bool subpages);
+
 int scsiLogSelect(scsi_device * device, int pcr, int sp, int pc, int pagenum,
                   int subpagenum, uint8_t *pBuf, int bufLen);
 
@@ -43,9 +43,6 @@ uint8_t gBuf[GBUF_SIZE];
 #define LOG_RESP_LONG_LEN ((62 * 256) + 252)
 #define LOG_RESP_TAPE_ALERT_LEN 0x144
 
-/* Supported log pages + Supported log pages and subpages maximum count */
-#define SCSI_SUPP_LOG_PAGES_MAX_COUNT (252 + (62 * 128) + 126)
-
 /* Log pages supported */
 static bool gSmartLPage = false;     /* Informational Exceptions log page */
 static bool gTempLPage = false;
@@ -139,100 +136,52 @@ static std::string rtrim(const std::string& s, const char* t = " \t\n\r\f\v")
     return r;
 }
 
+/* Reset state from a previous device, required if scsiPrintMain() is
+ * called more than once (smartctl --batch) */
 static void
-scsiGetSupportedLogPages(scsi_device * device)
+scsiResetPrintState(void)
 {
-    bool got_subpages = false;
-    int k, err, resp_len, num_unreported, num_unreported_spg;
-    int supp_lpg_and_spg_count = 0;
-
-    const uint8_t * up;
-    uint8_t sup_lpgs[LOG_RESP_LEN];
-    struct scsi_supp_log_pages supp_lpg_and_spg[SCSI_SUPP_LOG_PAGES_MAX_COUNT];
-
-    memset(gBuf, 0, LOG_RESP_LEN);
-    memset(supp_lpg_and_spg, 0, sizeof(supp_lpg_and_spg));
+    gSmartLPage = gTempLPage = gSelfTestLPage = gStartStopLPage = false;
+    gReadECounterLPage = gWriteECounterLPage = gVerifyECounterLPage = false;
+    gNonMediumELPage = gLastNErrorEvLPage = gBackgroundResultsLPage = false;
+    gProtocolSpecificLPage = gTapeAlertsLPage = gSSMediaLPage = false;
+    gFormatStatusLPage = gEnviroReportingLPage = gEnviroLimitsLPage = false;
+    gUtilizationLPage = gPendDefectsLPage = gBackgroundOpLPage = false;
+    gLPSMisalignLPage = gTapeDeviceStatsLPage = gZBDeviceStatsLPage = false;
+    gGenStatsAndPerfLPage = false;
+    gSeagateCacheLPage = gSeagateFactoryLPage = gSeagateFarmLPage = false;
+    gIecMPage = true;
+    modese_len = 0;
+    scsi_version = 0;
+    memset(scsi_vendor, 0, sizeof(scsi_vendor));
+}
 
-    if (SC_NO_SUPPORT == device->cmd_support_level(LOG_SENSE, false, 0)) {
-        if (scsi_debugmode > 0)
-            pout("%s: RSOC says %s not supported\n", __func__, logSenStr);
-        return;
-    }
-    /* Get supported log pages */
-    if ((err = scsiLogSense(device, SUPPORTED_LPAGES, 0, gBuf,
-                            LOG_RESP_LEN, 0 /* do double fetch */))) {
-        if (scsi_debugmode > 0)
-            pout("%s for supported pages failed [%s]\n", logSenStr,
-                 scsiErrString(err));
-        /* try one more time with defined length, workaround for the bug #678
-        found with ST8000NM0075/E001 */
-        err = scsiLogSense(device, SUPPORTED_LPAGES, 0, gBuf,
-                            LOG_RESP_LEN, 68); /* 64 max pages + 4b header */
+static void
+scsiGetSupportedLogPages(scsi_device * device)
+{
+    int k, err, num_unreported, num_unreported_spg;
+
+    /* Get supported log pages and subpages (SPC-4 or later) unless
+       already known for this device */
+    bool subpages = ((scsi_version >= SCSI_VERSION_SPC_4) &&
+                     (scsi_version <= SCSI_VERSION_HIGHEST));
+    /* unclear what code T10 will choose for SPC-6 */
+    if ((err = scsiReadSupportedLogPages(device, subpages))) {
         if (scsi_debugmode > 0)
-            pout("%s for supported pages failed (second attempt) [%s]\n",
+            pout("%s: %s for supported pages failed [%s]\n", __func__,
                  logSenStr, scsiErrString(err));
-        if (err)
-            return;
-    }
-
-    memcpy(sup_lpgs, gBuf, LOG_RESP_LEN);
-    resp_len = gBuf[3];
-    up = gBuf + LOGPAGEHDRSIZE;
-
-    for (k = 0; k < resp_len; k += 1) {
-        uint8_t page_code = 0x3f & up[k];
-        supp_lpg_and_spg[supp_lpg_and_spg_count++] = {page_code, 0};
-    }
-
-    if (SC_NO_SUPPORT ==
-        device->cmd_support_level(LOG_SENSE, false, 0,
-                                  true /* does it support subpages ? */))
-        goto skip_subpages;
-
-    /* Get supported log pages and subpages. Most drives seems to include the
-    supported log pages here as well, but some drives such as the Samsung
-    PM1643a will only report the additional log pages with subpages here */
-    if ((scsi_version >= SCSI_VERSION_SPC_4) &&
-            (scsi_version <= SCSI_VERSION_HIGHEST)) {
-        /* unclear what code T10 will choose for SPC-6 */
-        if ((err = scsiLogSense(device, SUPPORTED_LPAGES, SUPP_SPAGE_L_SPAGE,
-                                gBuf, LOG_RESP_LONG_LEN,
-                                -1 /* just single not double fetch */))) {
-            if (scsi_debugmode > 0)
-                pout("%s for supported pages and subpages failed [%s]\n",
-                     logSenStr, scsiErrString(err));
-        } else {
-            /* Ensure we didn't get the same answer than without the subpages */
-            if (0 == memcmp(gBuf, sup_lpgs, LOG_RESP_LEN)) {
-                if (scsi_debugmode > 0)
-                    pout("%s: %s ignored subpage field, bad\n",
-                         __func__, logSenRspStr);
-            } else if (! ((0x40 & gBuf[0]) &&
-                          (SUPP_SPAGE_L_SPAGE == gBuf[1]))) {
-                if (scsi_debugmode > 0)
-                    pout("%s supported subpages is bad SPF=%u SUBPG=%u\n",
-                         logSenRspStr, !! (0x40 & gBuf[0]), gBuf[2]);
-            } else {
-                got_subpages = true;
-            }
-        }
-    }
-
-    if (got_subpages) {
-        resp_len = sg_get_unaligned_be16(gBuf + 2);
-        up = gBuf + LOGPAGEHDRSIZE;
-        for (k = 0; k < resp_len; k += 2) {
-            uint8_t page_code = 0x3f & up[k];
-            uint8_t subpage_code = up[k+1];
-            supp_lpg_and_spg[supp_lpg_and_spg_count++] = {page_code, subpage_code};
-        }
+        return;
     }
+    const std::vector<unsigned short> & supp_lpg_and_spg =
+        device->page_support().get_log_pages();
 
-skip_subpages:
     num_unreported = 0;
     num_unreported_spg = 0;
-    for (k = 0; k < supp_lpg_and_spg_count; k += 1) {
-        struct scsi_supp_log_pages supp_lpg = supp_lpg_and_spg[k];
+    for (k = 0; k < (int)supp_lpg_and_spg.size(); k += 1) {
+        struct scsi_supp_log_pages supp_lpg = {
+            (uint8_t)(supp_lpg_and_spg[k] >> 8),
+            (uint8_t)supp_lpg_and_spg[k]
+        };
 
         switch (supp_lpg.page_code)
         {
@@ -3489,6 +3438,81 @@ scsiPrintEnviroReporting(scsi_device * device)
 }
 
 
+/* Fetch all log pages needed by the selected options once, so that the
+ * decoders below are served from the log cache attached to the device. */
+static void
+scsiPrefetchLogPages(scsi_device * device, const scsi_print_options & options,
+                     bool is_disk, bool is_tape, bool is_zbc)
+{
+    std::vector<int> plan; // (page << 8) | subpage
+    auto need = [&plan](bool supported, int page, int subpage) {
+        if (!supported)
+            return;
+        int ps = (page << 8) | subpage;
+        for (int p : plan)
+            if (p == ps)
+                return;
+        plan.push_back(ps);
+    };
+
+    if (options.smart_check_status) {
+        if (is_tape)
+            need(gTapeAlertsLPage && options.health_opt_count > 1,
+                 TAPE_ALERTS_LPAGE, 0);
+        else {
+            need(gSmartLPage, IE_LPAGE, 0);
+            need(gTempLPage, TEMPERATURE_LPAGE, 0);
+        }
+    }
+    if (is_disk && options.smart_ss_media_log) {
+        need(gSSMediaLPage, SS_MEDIA_LPAGE, 0);
+        need(gFormatStatusLPage, FORMAT_STATUS_LPAGE, 0);
+    }
+    if (options.smart_vendor_attrib) {
+        if (gEnviroReportingLPage && options.smart_env_rep)
+            need(true, TEMPERATURE_LPAGE, ENVIRO_REP_L_SPAGE);
+        else
+            need(gTempLPage, TEMPERATURE_LPAGE, 0);
+        need(gBackgroundResultsLPage && is_disk, BACKGROUND_RESULTS_LPAGE, 0);
+        need(gStartStopLPage, STARTSTOP_CYCLE_COUNTER_LPAGE, 0);
+        need(gSeagateCacheLPage && is_disk, SEAGATE_CACHE_LPAGE, 0);
+        need(gSeagateFactoryLPage && is_disk, SEAGATE_FACTORY_LPAGE, 0);
+    }
+    if (options.smart_error_log) {
+        need(gReadECounterLPage, READ_ERROR_COUNTER_LPAGE, 0);
+        need(gWriteECounterLPage, WRITE_ERROR_COUNTER_LPAGE, 0);
+        need(gVerifyECounterLPage, VERIFY_ERROR_COUNTER_LPAGE, 0);
+        need(gNonMediumELPage, NON_MEDIUM_ERROR_LPAGE, 0);
+        need(gLastNErrorEvLPage, LAST_N_ERROR_EVENTS_LPAGE, 0);
+    }
+    if (options.smart_error_log || options.scsi_pending_defects)
+        need(gPendDefectsLPage, BACKGROUND_RESULTS_LPAGE, PEND_DEFECTS_L_SPAGE);
+    if (options.smart_selftest_log)
+        need(gSelfTestLPage, SELFTEST_RESULTS_LPAGE, 0);
+    if (options.smart_background_log && is_disk)
+        need(gBackgroundResultsLPage, BACKGROUND_RESULTS_LPAGE, 0);
+    if (options.zoned_device_stats && is_zbc)
+        need(gZBDeviceStatsLPage, DEVICE_STATS_LPAGE, ZB_DEV_STATS_L_SPAGE);
+    if (options.general_stats_and_perf)
+        need(gGenStatsAndPerfLPage, GEN_STATS_PERF_LPAGE, 0);
+    if (is_tape) {
+        if (options.tape_device_stats)
+            need(gTapeDeviceStatsLPage, DEVICE_STATS_LPAGE, 0);
+        if (options.tape_alert)
+            need(gTapeAlertsLPage, TAPE_ALERTS_LPAGE, 0);
+    }
+    if (options.sasphy)
+        need(gProtocolSpecificLPage, PROTOCOL_SPECIFIC_LPAGE, 0);
+    if (options.smart_env_rep)
+        need(gEnviroReportingLPage, TEMPERATURE_LPAGE, ENVIRO_REP_L_SPAGE);
+
+    if (scsi_debugmode > 0)
+        pout("Prefetching %d log page(s)\n", (int)plan.size());
+    // Errors are ignored here, the decoder retries and reports them
+    for (int ps : plan)
+        scsiLogSense(device, ps >> 8, ps & 0xff, gBuf, LOG_RESP_LONG_LEN, 0);
+}
+
 /* Main entry point used by smartctl command. Return 0 for success */
 int
 scsiPrintMain(scsi_device * device, const scsi_print_options & options)
@@ -3503,6 +3527,10 @@ scsiPrintMain(scsi_device * device, const scsi_print_options & options)
     bool is_tape;
     bool any_output = options.drive_info;
 
+    scsiResetPrintState();
+    // Serve repeated LOG SENSE commands from memory
+    scsi_log_cache log_cache(device);
+
 // Enable -n option for SCSI Drives
     const char * powername = nullptr;
     bool powerchg = false;
@@ -3702,6 +3730,7 @@ scsiPrintMain(scsi_device * device, const scsi_print_options & options)
     // pages unless we have been told by RSOC that LOG SENSE is not supported
     if (SC_NO_SUPPORT != device->cmd_support_level(LOG_SENSE, false, 0))
         scsiGetSupportedLogPages(device);
+    scsiPrefetchLogPages(device, options, is_disk, is_tape, is_zbc);
 
     if (options.smart_check_status) {
         if (is_tape) {
@@ -3899,6 +3928,12 @@ scsiPrintMain(scsi_device * device, const scsi_print_options & options)
             any_output = true;
         }
     }
+    // Self-test commands below change the log pages
+    if (options.smart_default_selftest   || options.smart_short_cap_selftest ||
+        options.smart_short_selftest     || options.smart_extend_selftest ||
+        options.smart_extend_cap_selftest || options.smart_selftest_abort)
+        log_cache.clear();
+
     if (options.smart_default_selftest) {
         if (scsiSmartDefaultSelfTest(device))
             return returnval | FAILSMART;
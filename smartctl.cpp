@@ -20,9 +20,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
-#include <stdexcept>
 #include <getopt.h>
 
+#include <functional>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/wait.h>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
@@ -57,6 +65,21 @@ static bool print_as_json_output = false;
 static bool print_as_json_impl = false;
 static bool print_as_json_unimpl = false;
 
+// Control --batch mode
+static bool batch_mode = false; // set by --batch
+static bool batch_request = false; // parse_options() called for request line
+
+// Control multi-device mode
+struct multi_device_entry
+{
+  std::string name; // device name
+  std::string type; // '-d TYPE' or empty
+};
+static std::vector<multi_device_entry> multi_devices; // set if more than one device
+static int multi_parallel = 4; // set by --parallel=N
+
+static const char * capture_file = 0; // set by --capture=FILE
+
 static void printslogan()
 {
   jout("%s\n", format_version_info("smartctl").c_str());
@@ -134,6 +157,14 @@ static void Usage()
 "         Scan for devices\n\n"
 "  --scan-open\n"
 "         Scan for devices and try to open each device\n\n"
+"  --batch\n"
+"         Read device requests from stdin, print one JSON object per line\n\n"
+"  --scan-devices\n"
+"         Run on all devices found by device scan\n\n"
+"  --parallel=N\n"
+"         Run on up to N of multiple devices in parallel [default: 4]\n\n"
+"  --capture=FILE\n"
+"         Record all device commands to FILE, replay with '-d replay'\n\n"
   );
   pout(
 "================================== SMARTCTL RUN-TIME BEHAVIOR OPTIONS =====\n\n"
@@ -221,7 +252,8 @@ static void Usage()
 }
 
 // Values for  --long only options, see parse_options()
-enum { opt_identify = 1000, opt_scan, opt_scan_open, opt_set, opt_smart };
+enum { opt_identify = 1000, opt_scan, opt_scan_open, opt_set, opt_smart,
+       opt_batch, opt_scan_devices, opt_parallel, opt_capture };
 
 /* Returns a string containing a formatted list of the valid arguments
    to the option opt or empty on failure. Note 'v' case different */
@@ -276,6 +308,8 @@ static std::string getvalidarglist(int opt)
     return "c, g, i, o, s, u, v, y";
   case opt_identify:
     return "n, wn, w, v, wv, wb";
+  case opt_parallel:
+    return "1-128";
   case 'v':
   default:
     return "";
@@ -310,6 +344,18 @@ static checksum_err_mode_t checksum_err_mode = CHECKSUM_ERR_WARN;
 
 static void scan_devices(const smart_devtype_list & types, bool with_open, char ** argv);
 
+// Device info from --scan[-open]
+struct scan_open_result
+{
+  std::string name, info_name, type, protocol;
+  bool is_open = false;
+  std::string errmsg; // open error
+  long long probe_usec = 0; // time of autodetect_open()
+};
+
+static void scan_open_devices(smart_device_list & devlist, bool dont_print,
+  std::vector<scan_open_result> & results);
+
 
 /*      Takes command options and sets features to be run */    
 static int parse_options(int argc, char** argv, const char * & type,
@@ -355,6 +401,10 @@ static int parse_options(int argc, char** argv, const char * & type,
     { "set",             required_argument, 0, opt_set },
     { "scan",            no_argument,       0, opt_scan      },
     { "scan-open",       no_argument,       0, opt_scan_open },
+    { "batch",           no_argument,       0, opt_batch     },
+    { "scan-devices",    no_argument,       0, opt_scan_devices },
+    { "parallel",        required_argument, 0, opt_parallel  },
+    { "capture",         required_argument, 0, opt_capture   },
     { 0,                 0,                 0, 0   }
   };
 
@@ -363,9 +413,12 @@ static int parse_options(int argc, char** argv, const char * & type,
   opterr=optopt=0;
 
   smart_devtype_list scan_types; // multiple -d TYPE options for --scan
+  capture_file = 0;
   bool use_default_db = true; // set false on '-B FILE'
   bool output_format_set = false; // set true on '-f FORMAT'
   int scan = 0; // set by --scan, --scan-open
+  bool batch = false; // set by --batch
+  bool scan_devs = false; // set by --scan-devices
   bool badarg = false, captive = false;
   int testcnt = 0; // number of self-tests requested
 
@@ -942,6 +995,10 @@ static int parse_options(int argc, char** argv, const char * & type,
         badarg = true;
       break;
     case 'B':
+      if (batch_request) {
+        jerr("ERROR: -B option is not allowed in --batch requests\n");
+        return FAILCMD;
+      }
       {
         const char * path = optarg;
         if (*path == '+' && path[1])
@@ -1135,6 +1192,29 @@ static int parse_options(int argc, char** argv, const char * & type,
       scan = optchar;
       break;
 
+    case opt_batch:
+      batch = true;
+      break;
+
+    case opt_scan_devices:
+      scan_devs = true;
+      break;
+
+    case opt_parallel:
+      {
+        int n = -1, len = -1;
+        sscanf(optarg, "%d%n", &n, &len);
+        if (!(len == (int)strlen(optarg) && 1 <= n && n <= 128))
+          badarg = true;
+        else
+          multi_parallel = n;
+      }
+      break;
+
+    case opt_capture:
+      capture_file = optarg;
+      break;
+
     case 'j':
       {
         print_as_json = true;
@@ -1212,6 +1292,7 @@ static int parse_options(int argc, char** argv, const char * & type,
         (optchar == opt_identify ? "-identify" :
          optchar == opt_set ? "-set" :
          optchar == opt_smart ? "-smart" :
+         optchar == opt_parallel ? "-parallel" :
          optchar == 'j' ? "-json" : optstr), optarg);
       printvalidarglistmessage(optchar);
       if (extraerror[0])
@@ -1221,6 +1302,34 @@ static int parse_options(int argc, char** argv, const char * & type,
     }
   }
 
+  if (batch_request && (batch || scan || scan_devs || argc - optind > 1)) {
+    jerr("ERROR: --batch, --scan[-open], --scan-devices and multiple devices"
+         " are not allowed in --batch requests\n");
+    return FAILCMD;
+  }
+
+  if (capture_file && (batch || batch_request || scan || scan_devs || argc - optind > 1)) {
+    printslogan();
+    jerr("ERROR: --capture is only allowed with a single device\n");
+    UsageSummary();
+    return FAILCMD;
+  }
+
+  // Special handling of --batch
+  if (batch) {
+    if (scan || scan_devs || argc - optind > 0) {
+      printslogan();
+      jerr("ERROR: --batch does not accept --scan[-open], --scan-devices or a device name\n");
+      UsageSummary();
+      return FAILCMD;
+    }
+    // Read drive database once for all requests
+    if (!init_drive_database(use_default_db))
+      return FAILCMD;
+    batch_mode = true;
+    return -1;
+  }
+
   // Special handling of --scan, --scanopen
   if (scan) {
     // Read or init drive database to allow USB ID check.
@@ -1237,10 +1346,10 @@ static int parse_options(int argc, char** argv, const char * & type,
     printing_is_off = true;
 
   // Check for multiple -d TYPE options
-  if (scan_types.size() > 1) {
+  if (scan_types.size() > 1 && !scan_devs) {
     printing_is_off = false;
     printslogan();
-    jerr("ERROR: multiple -d TYPE options are only allowed with --scan\n");
+    jerr("ERROR: multiple -d TYPE options are only allowed with --scan[-devices]\n");
     UsageSummary();
     return FAILCMD;
   }
@@ -1291,7 +1400,61 @@ static int parse_options(int argc, char** argv, const char * & type,
 
   // From here on, normal operations...
   printslogan();
-  
+
+#ifdef _WIN32
+  if (scan_devs || argc - optind > 1) {
+    jerr("ERROR: --scan-devices and multiple device names are not supported on this platform\n");
+    UsageSummary();
+    return FAILCMD;
+  }
+#endif
+
+  // Select devices found by scan, '-d TYPE' options restrict the scan
+  if (scan_devs) {
+    if (argc - optind > 0) {
+      jerr("ERROR: --scan-devices does not accept a device name\n");
+      UsageSummary();
+      return FAILCMD;
+    }
+    // Read or init drive database to allow USB ID check.
+    if (!init_drive_database(use_default_db))
+      return FAILCMD;
+
+    bool dont_print = !(ata_debugmode || scsi_debugmode || nvme_debugmode);
+    smart_device_list devlist;
+    bool saved_printing_is_off = printing_is_off;
+    printing_is_off = dont_print;
+    bool ok = smi()->scan_smart_devices(devlist, scan_types);
+    printing_is_off = saved_printing_is_off;
+    if (!ok) {
+      jerr("scan_smart_devices: %s\n", smi()->get_errmsg());
+      return FAILCMD;
+    }
+    if (!devlist.size()) {
+      jerr("ERROR: --scan-devices: No devices found\n");
+      return FAILDEV;
+    }
+
+    // Select devices which could be opened, as printed by --scan-open
+    std::vector<scan_open_result> results;
+    scan_open_devices(devlist, dont_print, results);
+    printing_is_off = saved_printing_is_off;
+    for (const scan_open_result & r : results) {
+      if (!r.is_open) {
+        if (!dont_print)
+          pout("%s: Device open failed, ignored: %s\n", r.info_name.c_str(), r.errmsg.c_str());
+        continue;
+      }
+      multi_devices.push_back({r.name, r.type});
+    }
+    if (multi_devices.empty()) {
+      jerr("ERROR: --scan-devices: No devices could be opened\n");
+      return FAILDEV;
+    }
+    // No error, continue in main_worker()
+    return -1;
+  }
+
   // Warn if the user has provided no device name
   if (argc-optind<1){
     jerr("ERROR: smartctl requires a device name as the final command-line argument.\n\n");
@@ -1299,19 +1462,20 @@ static int parse_options(int argc, char** argv, const char * & type,
     return FAILCMD;
   }
   
-  // Warn if the user has provided more than one device name
+  // Run on each device if the user has provided more than one device name
   if (argc-optind>1){
-    int i;
-    jerr("ERROR: smartctl takes ONE device name as the final command-line argument.\n");
-    pout("You have provided %d device names:\n",argc-optind);
-    for (i=0; i<argc-optind; i++)
-      pout("%s\n",argv[optind+i]);
-    UsageSummary();
-    return FAILCMD;
+    for (int i = optind; i < argc; i++) {
+      if (!strcmp(argv[i], "-")) {
+        jerr("ERROR: Device name \"-\" is not allowed with multiple devices\n");
+        UsageSummary();
+        return FAILCMD;
+      }
+      multi_devices.push_back({argv[i], (type ? type : "")});
+    }
   }
 
-  // Read or init drive database
-  if (!init_drive_database(use_default_db))
+  // Read or init drive database, already done for --batch requests
+  if (!batch_request && !init_drive_database(use_default_db))
     return FAILCMD;
 
   // No error, continue in main_worker()
@@ -1320,6 +1484,18 @@ static int parse_options(int argc, char** argv, const char * & type,
 
 // Printing functions
 
+// State of JSON output collected by vjpout()
+static char js_output_buf[1024];
+static char * js_output_bufnext = js_output_buf;
+static int js_output_lineno = 0, js_output_outindex = 0, js_output_errindex = 0;
+
+// Reset JSON output state for next --batch request
+static void js_output_reset()
+{
+  js_output_bufnext = js_output_buf;
+  js_output_lineno = js_output_outindex = js_output_errindex = 0;
+}
+
 __attribute_format_printf(3, 0)
 static void vjpout(bool is_js_impl, const char * msg_severity,
                    const char *fmt, va_list ap)
@@ -1331,9 +1507,9 @@ static void vjpout(bool is_js_impl, const char * msg_severity,
   }
   else {
     // Add lines to JSON output
-    static char buf[1024];
-    static char * bufnext = buf;
-    vsnprintf(bufnext, sizeof(buf) - (bufnext - buf), fmt, ap);
+    char * const buf = js_output_buf;
+    char * & bufnext = js_output_bufnext;
+    vsnprintf(bufnext, sizeof(js_output_buf) - (bufnext - buf), fmt, ap);
     for (char * p = buf, *q; ; p = q) {
       if (!(q = strchr(p, '\n'))) {
         // Keep remaining line for next call
@@ -1343,20 +1519,17 @@ static void vjpout(bool is_js_impl, const char * msg_severity,
       }
       *q++ = 0; // '\n' -> '\0'
 
-      static int lineno = 0;
-      lineno++;
+      int lineno = ++js_output_lineno;
       if (print_as_json_output) {
         // Collect full output in array
-        static int outindex = 0;
-        jglb["smartctl"]["output"][outindex++] = p;
+        jglb["smartctl"]["output"][js_output_outindex++] = p;
       }
       if (!*p)
         continue; // Skip empty line
 
       if (msg_severity) {
         // Collect non-empty messages in array
-        static int errindex = 0;
-        json::ref jref = jglb["smartctl"]["messages"][errindex++];
+        json::ref jref = jglb["smartctl"]["messages"][js_output_errindex++];
         jref["string"] = p;
         jref["severity"] = msg_severity;
       }
@@ -1518,6 +1691,214 @@ static void js_device_info(const json::ref & jref, const smart_device * dev)
   jref["protocol"] = get_protocol_info(dev);
 }
 
+#ifndef _WIN32
+
+// Result of function run in child process
+struct child_result
+{
+  std::string output; // stdout of child
+  int status = -1; // exit status or -1 on error
+  std::string errmsg; // error message if status == -1
+};
+
+// Read file from beginning
+static std::string read_tmpfile(FILE * f)
+{
+  std::string str;
+  rewind(f);
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    str.append(buf, n);
+  return str;
+}
+
+// Run 'func(i)' for each element of 'results' in a child process, up to
+// '--parallel=N' at a time.  Stdout of each child is collected in a
+// temporary file which is read and closed when the child has finished.
+static void run_child_processes(std::vector<child_result> & results,
+  const std::function<int(unsigned)> & func)
+{
+  unsigned num = results.size();
+  std::map<pid_t, std::pair<unsigned, FILE *> > running; // pid -> index, output
+
+  fflush(stdout);
+  unsigned next = 0;
+  while (next < num || !running.empty()) {
+    // Start child processes
+    while (next < num && running.size() < (unsigned)multi_parallel) {
+      unsigned i = next++;
+      FILE * f = tmpfile();
+      if (!f) {
+        results[i].errmsg = strprintf("tmpfile() failed: %s", strerror(errno));
+        continue;
+      }
+      pid_t pid = fork();
+      if (pid < 0) {
+        results[i].errmsg = strprintf("fork() failed: %s", strerror(errno));
+        fclose(f);
+        continue;
+      }
+      if (!pid) {
+        // Child: Write all output to temporary file
+        if (dup2(fileno(f), STDOUT_FILENO) < 0)
+          _exit(FAILCMD);
+        int status = func(i);
+        fflush(stdout);
+        _exit(status & 0xff);
+      }
+      running[pid] = std::make_pair(i, f);
+    }
+    if (running.empty())
+      continue;
+
+    // Wait for any child
+    int wstatus = 0;
+    pid_t pid = waitpid(-1, &wstatus, 0);
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      throw std::runtime_error(strprintf("waitpid() failed: %s", strerror(errno)));
+    }
+    auto it = running.find(pid);
+    if (it == running.end())
+      continue;
+    unsigned i = it->second.first;
+    FILE * f = it->second.second;
+    running.erase(it);
+    results[i].output = read_tmpfile(f);
+    fclose(f);
+    if (WIFEXITED(wstatus))
+      results[i].status = WEXITSTATUS(wstatus);
+    else
+      results[i].errmsg = strprintf("Child process terminated by signal %d",
+                                    (WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : -1));
+  }
+}
+
+#endif // !_WIN32
+
+static void set_scan_result(scan_open_result & r, const smart_device * dev)
+{
+  r.name = dev->get_dev_name();
+  r.info_name = dev->get_info_name();
+  r.type = dev->get_dev_type();
+  r.protocol = get_protocol_info(dev);
+  r.is_open = dev->is_open();
+  if (!r.is_open)
+    r.errmsg = dev->get_errmsg();
+}
+
+// Open scanned device with autodetect support, close and delete it.
+static void scan_open_device(scan_open_result & r, smart_device * scandev)
+{
+  smart_device_auto_ptr dev(scandev);
+  long long start_usec = get_timer_usec();
+  dev.replace( dev->autodetect_open() );
+  r.probe_usec = get_timer_usec() - start_usec;
+  set_scan_result(r, dev.get());
+  if (dev->is_open())
+    dev->close();
+}
+
+#ifndef _WIN32
+
+// Append string field with '\\', TAB and LF escaped, terminated by TAB
+static void append_escaped_field(std::string & rec, const std::string & str)
+{
+  for (char c : str) {
+    switch (c) {
+      case '\\': rec += "\\\\"; break;
+      case '\t': rec += "\\t"; break;
+      case '\n': rec += "\\n"; break;
+      default: rec += c;
+    }
+  }
+  rec += '\t';
+}
+
+// Split record created by append_escaped_field()
+static std::vector<std::string> split_escaped_fields(const std::string & rec)
+{
+  std::vector<std::string> fields;
+  std::string field;
+  for (size_t i = 0; i < rec.size(); i++) {
+    char c = rec[i];
+    if (c == '\t') {
+      fields.push_back(field);
+      field.clear();
+    }
+    else if (c == '\\' && i + 1 < rec.size()) {
+      c = rec[++i];
+      field += (c == 't' ? '\t' : c == 'n' ? '\n' : c);
+    }
+    else
+      field += c;
+  }
+  return fields;
+}
+
+#endif // !_WIN32
+
+// Open all devices of 'devlist' with autodetect support, close them again.
+// Devices are probed in parallel child processes, up to '--parallel=N'
+// at a time, unless debug output is enabled.  'devlist' is emptied.
+static void scan_open_devices(smart_device_list & devlist, bool dont_print,
+  std::vector<scan_open_result> & results)
+{
+  unsigned num = devlist.size();
+  results.resize(num);
+
+#ifndef _WIN32
+  if (dont_print && num > 1 && multi_parallel > 1) {
+    std::vector<child_result> cresults(num);
+    run_child_processes(cresults,
+      [&](unsigned i) {
+        printing_is_off = true;
+        scan_open_result r;
+        scan_open_device(r, devlist.release(i));
+        std::string rec;
+        append_escaped_field(rec, strprintf("%d", (int)r.is_open));
+        append_escaped_field(rec, strprintf("%lld", r.probe_usec));
+        append_escaped_field(rec, r.name);
+        append_escaped_field(rec, r.info_name);
+        append_escaped_field(rec, r.type);
+        append_escaped_field(rec, r.protocol);
+        append_escaped_field(rec, r.errmsg);
+        fputs(rec.c_str(), stdout);
+        return 0;
+      });
+
+    for (unsigned i = 0; i < num; i++) {
+      scan_open_result & r = results[i];
+      std::vector<std::string> fields = split_escaped_fields(cresults[i].output);
+      smart_device_auto_ptr dev( devlist.release(i) );
+      if (cresults[i].status != 0 || fields.size() != 7) {
+        // Child failed, report as open error
+        set_scan_result(r, dev.get());
+        r.is_open = false;
+        r.errmsg = (!cresults[i].errmsg.empty() ? cresults[i].errmsg
+                                                : "Device probe failed");
+        continue;
+      }
+      r.is_open = (fields[0] == "1");
+      r.probe_usec = strtoll(fields[1].c_str(), nullptr, 10);
+      r.name = fields[2]; r.info_name = fields[3]; r.type = fields[4];
+      r.protocol = fields[5]; r.errmsg = fields[6];
+    }
+    devlist.clear();
+    return;
+  }
+#endif
+
+  for (unsigned i = 0; i < num; i++) {
+    printing_is_off = dont_print;
+    scan_open_device(results[i], devlist.release(i));
+    printing_is_off = false;
+  }
+  devlist.clear();
+}
+
 // Device scan
 // smartctl [-d type] --scan[-open] -- [PATTERN] [smartd directive ...]
 void scan_devices(const smart_devtype_list & types, bool with_open, char ** argv)
@@ -1539,74 +1920,48 @@ void scan_devices(const smart_devtype_list & types, bool with_open, char ** argv
     return;
   }
 
-  for (unsigned i = 0; i < devlist.size(); i++) {
-    smart_device_auto_ptr dev( devlist.release(i) );
-    json::ref jref = jglb["devices"][i];
-
-    if (with_open) {
-      printing_is_off = dont_print;
-      dev.replace ( dev->autodetect_open() );
-      printing_is_off = false;
-    }
+  std::vector<scan_open_result> results(devlist.size());
+  if (with_open)
+    scan_open_devices(devlist, dont_print, results);
+  else {
+    for (unsigned i = 0; i < devlist.size(); i++)
+      set_scan_result(results[i], devlist.at(i));
+  }
 
-    js_device_info(jref, dev.get());
+  for (unsigned i = 0; i < results.size(); i++) {
+    const scan_open_result & r = results[i];
+    json::ref jref = jglb["devices"][i];
 
-    if (with_open && !dev->is_open()) {
-      jout("# %s -d %s # %s, %s device open failed: %s\n", dev->get_dev_name(),
-           dev->get_dev_type(), dev->get_info_name(),
-           get_protocol_info(dev.get()), dev->get_errmsg());
-      jref["open_error"] = dev->get_errmsg();
+    jref["name"] = r.name;
+    jref["info_name"] = r.info_name;
+    jref["type"] = r.type;
+    jref["protocol"] = r.protocol;
+    if (with_open)
+      jref["probe_milliseconds"] = r.probe_usec / 1000;
+
+    if (with_open && !r.is_open) {
+      jout("# %s -d %s # %s, %s device open failed: %s\n", r.name.c_str(),
+           r.type.c_str(), r.info_name.c_str(), r.protocol.c_str(), r.errmsg.c_str());
+      jref["open_error"] = r.errmsg;
       continue;
     }
 
-    jout("%s -d %s", dev->get_dev_name(), dev->get_dev_type());
+    jout("%s -d %s", r.name.c_str(), r.type.c_str());
     if (!argv[ai])
-      jout(" # %s, %s device\n", dev->get_info_name(), get_protocol_info(dev.get()));
+      jout(" # %s, %s device\n", r.info_name.c_str(), r.protocol.c_str());
     else {
       for (int j = ai; argv[j]; j++)
         jout(" %s", argv[j]);
       jout("\n");
     }
-
-    if (dev->is_open())
-      dev->close();
   }
 }
 
-// Main program without exception handling
-static int main_worker(int argc, char **argv)
+// Get device object and open it with autodetect support.
+// Return -1 on success, exit status otherwise.
+static int open_smart_device(smart_device_auto_ptr & dev, const char * name,
+  const char * type, const ata_print_options & ataopts, bool print_type_only)
 {
-  // Throw if runtime environment does not match compile time test.
-  check_config();
-
-  // Initialize interface
-  smart_interface::init();
-  if (!smi())
-    return 1;
-
-  // Parse input arguments
-  const char * type = 0;
-  ata_print_options ataopts;
-  scsi_print_options scsiopts;
-  nvme_print_options nvmeopts;
-  bool print_type_only = false;
-  {
-    int status = parse_options(argc, argv, type, ataopts, scsiopts, nvmeopts, print_type_only);
-    if (status >= 0)
-      return status;
-  }
-
-  // Store formatted current time for jout_startup_datetime()
-  // Output as JSON regardless of '-i' option
-  {
-    time_t now = time(nullptr);
-    dateandtimezoneepoch(startup_datetime_buf, now);
-    jglb["local_time"] += { {"time_t", now}, {"asctime", startup_datetime_buf} };
-  }
-
-  const char * name = argv[argc-1];
-
-  smart_device_auto_ptr dev;
   if (!strcmp(name,"-")) {
     // Parse "smartctl -r ataioctl,2 ..." output from stdin
     if (type || print_type_only) {
@@ -1659,14 +2014,31 @@ static int main_worker(int argc, char **argv)
     return FAILDEV;
   }
 
+  // Record all pass-through commands if requested
+  if (capture_file) {
+    dev.replace( smi()->get_capture_device(dev.get(), capture_file) );
+    if (!dev) {
+      jerr("Smartctl open capture file: %s\n", smi()->get_errmsg());
+      return FAILCMD;
+    }
+  }
+
+  return -1;
+}
+
+// Print information for an open device.
+static int print_smart_device(smart_device * dev, const ata_print_options & ataopts,
+  const scsi_print_options & scsiopts, const nvme_print_options & nvmeopts,
+  bool print_type_only)
+{
   // Add JSON info similar to --scan output
-  js_device_info(jglb["device"], dev.get());
+  js_device_info(jglb["device"], dev);
 
   // now call appropriate ATA or SCSI routine
   int retval = 0;
   if (print_type_only)
     jout("%s: Device of type '%s' [%s] opened\n",
-         dev->get_info_name(), dev->get_dev_type(), get_protocol_info(dev.get()));
+         dev->get_info_name(), dev->get_dev_type(), get_protocol_info(dev));
   else if (dev->is_ata())
     retval = ataPrintMain(dev->to_ata(), ataopts);
   else if (dev->is_scsi())
@@ -1677,6 +2049,358 @@ static int main_worker(int argc, char **argv)
     // we should never fall into this branch!
     pout("%s: Neither ATA, SCSI nor NVMe device\n", dev->get_info_name());
 
+  return retval;
+}
+
+// Store formatted current time for jout_startup_datetime()
+// Output as JSON regardless of '-i' option
+static void set_startup_datetime()
+{
+  time_t now = time(nullptr);
+  dateandtimezoneepoch(startup_datetime_buf, now);
+  jglb["local_time"] += { {"time_t", now}, {"asctime", startup_datetime_buf} };
+}
+
+// Reset getopt_long() for next parse_options() call
+static void reset_getopt()
+{
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) \
+ || defined(__DragonFly__) || defined(__APPLE__)
+  optreset = 1;
+  optind = 1;
+#else
+  optind = 0; // GNU and musl getopt(): reinitialize
+#endif
+}
+
+// Split request line into arguments, double quotes may be used
+// to include spaces. Return false on syntax error.
+static bool split_request_line(const char * line, std::vector<std::string> & args)
+{
+  args.clear();
+  for (const char * p = line; ; ) {
+    while (*p == ' ' || *p == '\t')
+      p++;
+    if (!*p || *p == '\n' || *p == '\r')
+      return true;
+    std::string arg;
+    while (*p && !strchr(" \t\r\n", *p)) {
+      if (*p != '"') {
+        arg += *p++;
+        continue;
+      }
+      const char * q = strchr(++p, '"');
+      if (!q)
+        return false;
+      arg.append(p, q - p);
+      p = q + 1;
+    }
+    args.push_back(arg);
+  }
+}
+
+// smartctl [-B FILE] [-r TYPE] [-j FLAGS] --batch
+// Read requests "[options] device" from stdin, print one line of
+// compact JSON output per request.  Devices remain open between requests.
+static int run_batch()
+{
+  // Settings from command line are used as defaults for each request
+  const bool json_verbose = jglb.is_verbose();
+  const json::print_options json_options = print_as_json_options;
+  const bool json_output = print_as_json_output,
+             json_impl = print_as_json_impl, json_unimpl = print_as_json_unimpl;
+  const unsigned char ata_debug = ata_debugmode, scsi_debug = scsi_debugmode,
+                      nvme_debug = nvme_debugmode;
+
+  // Open devices, key is "NAME\nTYPE" of request
+  smart_device_list devlist;
+  std::map<std::string, unsigned> devindex;
+
+  // Remove device from cache, next request will open it again
+  auto drop_device = [&](const std::string & key) {
+    auto it = devindex.find(key);
+    if (it == devindex.end())
+      return;
+    smart_device * dev = devlist.release(it->second);
+    if (dev->is_open())
+      dev->close();
+    delete dev;
+    devindex.erase(it);
+  };
+
+  batch_request = true;
+  char line[4096];
+  while (fgets(line, sizeof(line), stdin)) {
+    std::vector<std::string> args;
+    bool ok = split_request_line(line, args);
+    if (ok && (args.empty() || args[0][0] == '#'))
+      continue; // Skip empty line or comment
+
+    // Reset state of previous request
+    jglb.clear();
+    js_output_reset();
+    printing_is_switchable = printing_is_off = false;
+    failuretest_conservative = false; failuretest_permissive = 0;
+    checksum_err_mode = CHECKSUM_ERR_WARN;
+    dont_print_serial_number = false;
+    ata_debugmode = ata_debug; scsi_debugmode = scsi_debug; nvme_debugmode = nvme_debug;
+    print_as_json = true;
+    print_as_json_options = json_options;
+    print_as_json_output = json_output;
+    print_as_json_impl = json_impl; print_as_json_unimpl = json_unimpl;
+
+    std::vector<char *> argv;
+    argv.push_back(const_cast<char *>("smartctl"));
+    for (std::string & arg : args)
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    int argc = (int)argv.size() - 1;
+    js_initialize(argc, argv.data(), json_verbose);
+
+    int status;
+    std::string used_key; // cache key of device used by this request
+    try {
+      const char * type = 0;
+      ata_print_options ataopts;
+      scsi_print_options scsiopts;
+      nvme_print_options nvmeopts;
+      bool print_type_only = false;
+
+      if (!ok) {
+        jerr("ERROR: Missing closing quote in request line\n");
+        status = FAILCMD;
+      }
+      else if (!(strlen(line) < sizeof(line) - 1 || line[sizeof(line) - 2] == '\n')) {
+        jerr("ERROR: Request line too long\n");
+        status = FAILCMD;
+        // Skip rest of line
+        while (fgets(line, sizeof(line), stdin) && !strchr(line, '\n'))
+          ;
+      }
+      else {
+        reset_getopt();
+        status = parse_options(argc, argv.data(), type, ataopts, scsiopts, nvmeopts,
+                               print_type_only);
+        // Output is always compact JSON, one line per request
+        print_as_json = true;
+        print_as_json_options.pretty = false;
+        print_as_json_options.format = 0;
+      }
+      if (status < 0) {
+        set_startup_datetime();
+        const char * name = argv[argc-1];
+        std::string key = strprintf("%s\n%s", name, (type ? type : ""));
+
+        smart_device * dev = nullptr;
+        auto it = devindex.find(key);
+        if (it != devindex.end()) {
+          dev = devlist.at(it->second);
+          if (!dev->is_open()) {
+            // Closed or reopen failed, try again below
+            drop_device(key);
+            dev = nullptr;
+          }
+        }
+
+        if (!dev) {
+          if (!strcmp(name, "-")) {
+            jerr("ERROR: Device name \"-\" is not allowed in --batch requests\n");
+            status = FAILCMD;
+          }
+          else {
+            smart_device_auto_ptr newdev;
+            status = open_smart_device(newdev, name, type, ataopts, print_type_only);
+            if (status < 0) {
+              dev = newdev.get();
+              devindex[key] = devlist.size();
+              devlist.push_back(newdev);
+            }
+          }
+        }
+        else if (dev->is_ata() && ataopts.powermode>=2 && dev->is_powered_down()) {
+          jinf("Device is in STANDBY (OS) mode, exit(%d)\n", ataopts.powerexit);
+          status = ataopts.powerexit;
+        }
+        else if (print_type_only)
+          pout("%s: Device of type '%s' [%s] detected\n",
+               dev->get_info_name(), dev->get_dev_type(), get_protocol_info(dev));
+
+        if (status < 0) {
+          used_key = key;
+          dev->clear_err();
+          status = print_smart_device(dev, ataopts, scsiopts, nvmeopts, print_type_only);
+          // Device may have been removed or replaced, open it again next time
+          int err = dev->get_errno();
+          if ((status & (FAILDEV|FAILID)) || err == ENODEV || err == ENXIO)
+            drop_device(key);
+        }
+      }
+    }
+    catch (int ex) {
+      // Exit status from checksumwarning() and failuretest() arrives here
+      status = ex;
+    }
+    catch (const std::exception & ex) {
+      // Other errors from device access, continue with next request
+      jerr("Smartctl: Exception: %s\n", ex.what());
+      status = FAILCMD;
+      if (!used_key.empty())
+        drop_device(used_key);
+    }
+
+    if (jglb.has_uint128_output())
+      jglb["smartctl"]["uint128_precision_bits"] = uint128_to_str_precision_bits();
+    jglb["smartctl"]["exit_status"] = status;
+    jglb.print(stdout, print_as_json_options);
+    putchar('\n');
+    fflush(stdout);
+  }
+  batch_request = false;
+
+  for (unsigned i = 0; i < devlist.size(); i++) {
+    smart_device * dev = devlist.at(i);
+    if (dev && dev->is_open())
+      dev->close();
+  }
+
+  // Nothing to print in main()
+  jglb.clear();
+  return 0;
+}
+
+#ifndef _WIN32
+
+// Run on one device of multi-device mode in child process.
+// Output (compact JSON if enabled) is written to stdout.
+static int run_multi_device_child(const multi_device_entry & md,
+  const ata_print_options & ataopts, const scsi_print_options & scsiopts,
+  const nvme_print_options & nvmeopts, bool print_type_only)
+{
+  int status;
+  try {
+    set_startup_datetime();
+    smart_device_auto_ptr dev;
+    status = open_smart_device(dev, md.name.c_str(),
+                               (!md.type.empty() ? md.type.c_str() : nullptr),
+                               ataopts, print_type_only);
+    if (status < 0) {
+      status = print_smart_device(dev.get(), ataopts, scsiopts, nvmeopts, print_type_only);
+      dev->close();
+    }
+  }
+  catch (int ex) {
+    // Exit status from checksumwarning() and failuretest() arrives here
+    status = ex;
+  }
+  catch (const std::exception & ex) {
+    jerr("Smartctl: Exception: %s\n", ex.what());
+    status = FAILCMD;
+  }
+
+  if (jglb.has_uint128_output())
+    jglb["smartctl"]["uint128_precision_bits"] = uint128_to_str_precision_bits();
+  jglb["smartctl"]["exit_status"] = status;
+  json::print_options opts; opts.pretty = false;
+  jglb.print(stdout, opts);
+  fflush(stdout);
+  return status;
+}
+
+// smartctl [options] DEVICE DEVICE ...
+// smartctl [options] [-d TYPE ...] --scan-devices
+// Run on each device in a child process, up to '--parallel=N' at a time.
+// Results are collected in temporary files and printed in device order,
+// JSON output is combined into the "devices" array.
+static int run_multi_devices(const ata_print_options & ataopts,
+  const scsi_print_options & scsiopts, const nvme_print_options & nvmeopts,
+  bool print_type_only)
+{
+  unsigned num = multi_devices.size();
+  std::vector<child_result> results(num);
+  run_child_processes(results,
+    [&](unsigned i) {
+      return run_multi_device_child(multi_devices[i], ataopts, scsiopts,
+                                    nvmeopts, print_type_only);
+    });
+
+  // Print results in device order
+  int retval = 0;
+  for (unsigned i = 0; i < num; i++) {
+    const multi_device_entry & md = multi_devices[i];
+    const std::string & out = results[i].output;
+    int status = results[i].status;
+    if (status < 0) {
+      jerr("%s: %s\n", md.name.c_str(), results[i].errmsg.c_str());
+      status = FAILCMD;
+    }
+
+    if (print_as_json) {
+      json::ref jref = jglb["devices"][i];
+      if (!jref.set_from_json(out.c_str())) {
+        // Child failed before JSON output
+        jref["device"]["name"] = md.name;
+        if (!md.type.empty())
+          jref["device"]["type"] = md.type;
+        jref["smartctl"]["exit_status"] = status;
+      }
+    }
+    else {
+      pout("\n=== %s%s%s ===\n", md.name.c_str(),
+           (!md.type.empty() ? " -d " : ""), md.type.c_str());
+      fwrite(out.data(), 1, out.size(), stdout);
+      fflush(stdout);
+    }
+    retval |= status;
+  }
+  return retval;
+}
+
+#endif // !_WIN32
+
+// Main program without exception handling
+static int main_worker(int argc, char **argv)
+{
+  // Throw if runtime environment does not match compile time test.
+  check_config();
+
+  // Initialize interface
+  smart_interface::init();
+  if (!smi())
+    return 1;
+
+  // Parse input arguments
+  const char * type = 0;
+  ata_print_options ataopts;
+  scsi_print_options scsiopts;
+  nvme_print_options nvmeopts;
+  bool print_type_only = false;
+  {
+    int status = parse_options(argc, argv, type, ataopts, scsiopts, nvmeopts, print_type_only);
+    if (status >= 0)
+      return status;
+  }
+
+  if (batch_mode)
+    return run_batch();
+
+#ifndef _WIN32
+  if (!multi_devices.empty())
+    return run_multi_devices(ataopts, scsiopts, nvmeopts, print_type_only);
+#endif
+
+  set_startup_datetime();
+
+  const char * name = argv[argc-1];
+
+  smart_device_auto_ptr dev;
+  {
+    int status = open_smart_device(dev, name, type, ataopts, print_type_only);
+    if (status >= 0)
+      return status;
+  }
+
+  int retval = print_smart_device(dev.get(), ataopts, scsiopts, nvmeopts, print_type_only);
+
   dev->close();
   return retval;
 }
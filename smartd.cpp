@@ -32,15 +32,20 @@
 #include <map>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 // conditionally included files
 #ifndef _WIN32
+#include <sys/resource.h> // getrusage()
 #include <sys/wait.h>
 #endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#ifdef __linux__
+#include <dirent.h> // opendir()
+#endif
 
 #ifdef _WIN32
 #include "os_win32/popen.h" // popen_as_rstr_user(), pclose()
@@ -68,6 +73,7 @@ typedef int pid_t;
 // locally included files
 #include "atacmds.h"
 #include "dev_interface.h"
+#include "dev_sim.h"
 #include "knowndrives.h"
 #include "scsicmds.h"
 #include "nvmecmds.h"
@@ -199,10 +205,26 @@ static bool warn_as_restr_user;
 // command-line: when should we exit?
 enum quit_t {
   QUIT_NODEV, QUIT_NODEVSTARTUP, QUIT_NEVER, QUIT_ONECHECK,
-  QUIT_SHOWTESTS, QUIT_ERRORS
+  QUIT_SHOWTESTS, QUIT_ERRORS, QUIT_BENCHMARK
 };
 static quit_t quit = QUIT_NODEV;
 static bool quit_nodev0 = false;
+static int quit_benchmark_cycles = 0; // set by '-q benchmark,N'
+
+// command-line: keep devices open between checks?
+static bool keep_open = false;
+
+// command-line: time budget of a check cycle in seconds, 0 if none
+static int cycle_budget = 0;
+
+// command-line: spread checks by per-device phase offsets ('--stagger=MODE')
+enum stagger_mode_t { STAGGER_NONE, STAGGER_POSITION, STAGGER_SERIAL };
+static stagger_mode_t stagger_mode = STAGGER_NONE;
+
+#ifdef __linux__
+// Root of sysfs, set by '--sysfs-root=DIR'
+static std::string sysfs_root = "/sys";
+#endif
 
 // command-line; this is the default syslog(3) log facility to use.
 static int facility=LOG_DAEMON;
@@ -394,6 +416,8 @@ struct dev_config
   std::string state_file;                 // Path of the persistent state file, empty if none
   std::string attrlog_file;               // Path of the persistent attrlog file, empty if none
   int checktime{};                        // Individual check interval, 0 if none
+  int checktime_max{};                    // Max adaptive check interval, 0 if fixed
+  int hwmontime{};                        // Temperature poll interval via hwmon, 0 if none
   bool ignore{};                          // Ignore this entry
   bool id_is_unique{};                    // True if dev_idinfo is unique (includes S/N or WWN)
   bool smartcheck{};                      // Check SMART status
@@ -416,7 +440,10 @@ struct dev_config
   bool removable{};                       // Device may disappear (not be present)
   char powermode{};                       // skip check, if disk in idle or standby mode
   bool powerquiet{};                      // skip powermode 'skipping checks' message
+  bool powerio{};                         // use I/O statistics before powermode check
   int powerskipmax{};                     // how many times can be check skipped
+  int powerstale{};                       // Max hours since last check before skip is ignored, 0 if no limit
+  int powerpoll{};                        // Poll I/O statistics every N seconds while skipped, 0 if none
   unsigned char tempdiff{};               // Track Temperature changes >= this limit
   unsigned char tempinfo{}, tempcrit{};   // Track Temperatures >= these limits as LOG_INFO, LOG_CRIT+mail
   regular_expression test_regex;          // Regex for scheduled testing
@@ -430,6 +457,16 @@ struct dev_config
 
   // ATA ONLY
   int dev_rpm{};                          // rotation rate, 0 = unknown, 1 = SSD, >1 = HDD
+  int logcheck{};                         // Read logs at least every N checks, 0 = default
+  int testbusy{};                         // Postpone self-tests above N I/O requests/s, 0 if none
+  int testlat{};                          // Abort selective self-tests above N ms I/O latency, 0 if none
+  int scrubdays{};                        // Scrub full disk with selective self-tests every N days, 0 if none
+  int scrubtime{};                        // Daily self-test time budget for scrub (minutes), 0 = default
+  int testmax{};                          // Max running self-tests on all devices, 0 if no limit
+  int testmaxgroup{};                     // Max running self-tests in topology group, 0 if no limit
+  int timeout{};                          // Command timeout (seconds), 0 = default
+  int logtimeout{};                       // Command timeout for log reads (seconds), 0 = timeout
+  int quarantine{3};                      // Quarantine after N checks with timeouts, 0 = never
   int set_aam{};                          // disable(-1), enable(1..255->0..254) Automatic Acoustic Management
   int set_apm{};                          // disable(-1), enable(2..255->1..254) Advanced Power Management
   int set_lookahead{};                    // disable(-1), enable(1) read look-ahead
@@ -467,6 +504,41 @@ struct mailinfo {
   time_t lastsent{};    // time last email was sent, as defined by time(2)
 };
 
+/// Copyable owner of bulky protocol specific state data.
+/// The data is allocated on first non-const access.  Const access
+/// to data not yet allocated returns a default initialized object.
+template <class T>
+class dev_state_part
+{
+public:
+  dev_state_part() = default;
+
+  dev_state_part(const dev_state_part & x)
+    : m_ptr(x.m_ptr ? new T(*x.m_ptr) : nullptr) { }
+
+  dev_state_part & operator=(const dev_state_part & x)
+    { if (this != &x) m_ptr.reset(x.m_ptr ? new T(*x.m_ptr) : nullptr);
+      return *this; }
+
+  bool allocated() const
+    { return !!m_ptr; }
+
+  T * operator->()
+    { if (!m_ptr) m_ptr.reset(new T());
+      return m_ptr.get(); }
+
+  const T * operator->() const
+    { static const T empty{};
+      return (m_ptr ? m_ptr.get() : &empty); }
+
+  /// Return size of allocated data.
+  size_t mem_size() const
+    { return (m_ptr ? sizeof(T) : 0); }
+
+private:
+  std::unique_ptr<T> m_ptr;
+};
+
 /// Persistent state data for a device.
 struct persistent_dev_state
 {
@@ -480,10 +552,17 @@ struct persistent_dev_state
   uint64_t selective_test_last_start{};   // Start LBA of last scheduled selective self-test
   uint64_t selective_test_last_end{};     // End LBA of last scheduled selective self-test
 
+  time_t scrub_pass_start{};              // Start time of current scrub pass ('-c scrub=N')
+  time_t scrub_day_start{};               // Start time of current daily scrub budget
+  unsigned scrub_day_seconds{};           // Self-test time used since scrub_day_start
+  uint64_t scrub_day_sectors{};           // Sectors scrubbed since scrub_day_start
+  uint64_t scrub_rate{};                  // Measured selective self-test rate (LBAs/s), 0 if unknown
+
   mailinfo maillog[SMARTD_NMAIL];         // log info on when mail sent
 
   // ATA ONLY
   int ataerrorcount{};                    // Total number of ATA errors
+  unsigned char ata_log_ext_single{};     // Multi-sector READ LOG EXT not supported
 
   // Persistent part of ata_smart_values:
   struct ata_attribute {
@@ -493,33 +572,65 @@ struct persistent_dev_state
     uint64_t raw{};
     unsigned char resvd{};
   };
-  ata_attribute ata_attributes[NUMBER_ATA_SMART_ATTRIBUTES];
-  
+  struct ata_attribute_table {
+    ata_attribute attr[NUMBER_ATA_SMART_ATTRIBUTES];
+  };
+  dev_state_part<ata_attribute_table> ata_attributes;
+
   // SCSI ONLY
 
   struct scsi_error_counter_t {
     struct scsiErrorCounter errCounter{};
     unsigned char found{};
   };
-  scsi_error_counter_t scsi_error_counters[3];
-
   struct scsi_nonmedium_error_t {
     struct scsiNonMediumError nme{};
     unsigned char found{};
   };
-  scsi_nonmedium_error_t scsi_nonmedium_error;
+  struct scsi_error_logs {
+    scsi_error_counter_t counters[3];
+    scsi_nonmedium_error_t nonmedium;
+  };
+  dev_state_part<scsi_error_logs> scsi_errors;
 
   // NVMe only
   uint64_t nvme_err_log_entries{};
 };
 
+/// I/O statistics sample of a block device.
+struct io_stat_sample
+{
+  uint64_t ios{};                         // Completed requests
+  uint64_t ticks{};                       // Milliseconds spent by completed requests
+  uint64_t inflight{};                    // Requests in flight
+  time_t time{};                          // Time of sample, 0 if invalid
+};
+
 /// Non-persistent state data for a device.
 struct temp_dev_state
 {
+  // Small fields used at each check cycle
   bool must_write{};                      // true if persistent part should be written
-
   bool skip{};                            // skip during next check cycle
+  bool removed{};                         // true if open() failed for removable device
+  bool powermodefail{};                   // true if power mode check failed
+  bool attrlog_dirty{};                   // true if persistent part has new attr values that
+                                          // need to be written to attrlog
+  unsigned char temperature{};            // last recorded Temperature (in Celsius)
+  int powerskipcnt{};                     // Number of checks skipped due to idle or standby mode
+  int lastpowermodeskipped{};             // the last power mode that was skipped
   time_t wakeuptime{};                    // next wakeup time, 0 if unknown or global
+  time_t tempmin_delay{};                 // time where Min Temperature tracking will start
+  time_t hwmon_wakeuptime{};              // next hwmon temperature poll time
+  int risk{};                             // Risk score from recent checks, determines check order
+  int checktime_cur{};                    // Current adaptive check interval, 0 if not yet set
+  bool trend_changed{};                   // Changes or threshold approach detected since last check
+  uint32_t phase{};                       // Phase offset of checks in units of interval/2^32 ('--stagger')
+  int timeout_count{};                    // Number of consecutive checks with command timeout
+  time_t retry_time{};                    // Next check not before this time after timeout
+  bool quarantined{};                     // Too many checks with timeout ('-c quarantine=N')
+  bool deferred{};                        // Check deferred due to '--cycle-budget'
+  bool first_check{};                     // Skipped in first pass ('--stagger'), next check is first
 
   bool not_cap_offline{};                 // true == not capable of offline testing
   bool not_cap_conveyance{};
@@ -527,17 +638,26 @@ struct temp_dev_state
   bool not_cap_long{};
   bool not_cap_selective{};
 
-  unsigned char temperature{};            // last recorded Temperature (in Celsius)
-  time_t tempmin_delay{};                 // time where Min Temperature tracking will start
-
-  bool removed{};                         // true if open() failed for removable device
-
-  bool powermodefail{};                   // true if power mode check failed
-  int powerskipcnt{};                     // Number of checks skipped due to idle or standby mode
-  int lastpowermodeskipped{};             // the last power mode that was skipped
-
-  bool attrlog_dirty{};                   // true if persistent part has new attr values that
-                                          // need to be written to attrlog
+  std::string hwmon_temp_file;            // hwmon 'temp1_input' file, empty if none
+  std::string io_stat_file;               // '/sys/block/NAME/stat' for '-n ...,io', empty if none
+  uint64_t io_count{};                    // I/O count from io_stat_file at last check
+  bool io_active{};                       // true if I/O occurred since last check
+  time_t io_poll_wakeuptime{};            // next I/O poll time while skipped ('-c powerpoll=N')
+  bool io_woken{};                        // I/O detected by poll, check at next wakeup
+  time_t power_lastcheck{};               // Time of last check not skipped due to power mode
+  io_stat_sample io_sample;               // I/O statistics at last check
+  double io_rate{-1};                     // I/O requests/s since last check, <0 if unknown
+  double io_latency{-1};                  // Mean I/O latency (ms) since last check, <0 if unknown
+  double io_latency_idle{-1};             // Mean I/O latency without running self-test
+  char test_postponed{};                  // Scheduled self-test postponed due to I/O load
+  time_t test_postponed_time{};           // Time of first postponement
+  bool test_resume{};                     // Postponed 'r' test resumes at selective_test_last_start
+  time_t scrub_test_start{};              // Start time of running scrub span, 0 if none
+  char test_running{};                    // Type of self-test started and still running
+  bool test_queued{};                     // test_postponed waits for '-c testmax[group]=N' slot
+  bool test_slot_reserved{};              // Slot for queued test reserved in this cycle
+  std::string test_group;                 // Topology group for '-c testmaxgroup=N', empty if none
+  uint64_t test_io_ios{}, test_io_ticks{}; // I/O while self-test is running
 
   // SCSI ONLY
   // TODO: change to bool
@@ -552,10 +672,15 @@ struct temp_dev_state
                                           // know yet) 6 or 10
   // ATA ONLY
   uint64_t num_sectors{};                 // Number of sectors
-  ata_smart_values smartval{};            // SMART data
-  ata_smart_thresholds_pvt smartthres{};  // SMART thresholds
+  struct ata_smart_data {
+    ata_smart_values smartval{};          // SMART data
+    ata_smart_thresholds_pvt smartthres{}; // SMART thresholds
+  };
+  dev_state_part<ata_smart_data> ata_data;
   bool offline_started{};                 // true if offline data collection was started
   bool selftest_started{};                // true if self-test was started
+  int logcheck_skipcnt{};                 // Number of checks with self-test/error log reads skipped
+  uint64_t logcheck_poh{};                // Power on hours raw value at last log read
 };
 
 /// Runtime state data for a device.
@@ -565,6 +690,9 @@ struct dev_state
 {
   void update_persistent_state();
   void update_temp_state();
+
+  /// Return memory used by this state.
+  size_t mem_size() const;
 };
 
 /// Container for configuration info for each device.
@@ -573,12 +701,15 @@ typedef std::vector<dev_config> dev_config_vector;
 /// Container for state info for each device.
 typedef std::vector<dev_state> dev_state_vector;
 
+/// Index of registered devices: identity -> device name.
+typedef std::unordered_map<std::string, std::string> dev_name_index;
+
 // Copy ATA attributes to persistent state.
 void dev_state::update_persistent_state()
 {
   for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
-    const ata_smart_attribute & ta = smartval.vendor_attributes[i];
-    ata_attribute & pa = ata_attributes[i];
+    const ata_smart_attribute & ta = ata_data->smartval.vendor_attributes[i];
+    ata_attribute & pa = ata_attributes->attr[i];
     pa.id = ta.id;
     if (ta.id == 0) {
       pa.val = pa.worst = 0; pa.raw = 0;
@@ -596,12 +727,20 @@ void dev_state::update_persistent_state()
   }
 }
 
+size_t dev_state::mem_size() const
+{
+  return sizeof(*this) + ata_attributes.mem_size() + scsi_errors.mem_size()
+         + ata_data.mem_size();
+}
+
 // Copy ATA from persistent to temp state.
 void dev_state::update_temp_state()
 {
+  if (!ata_attributes.allocated())
+    return;
   for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
-    const ata_attribute & pa = ata_attributes[i];
-    ata_smart_attribute & ta = smartval.vendor_attributes[i];
+    const ata_attribute & pa = ata_attributes->attr[i];
+    ata_smart_attribute & ta = ata_data->smartval.vendor_attributes[i];
     ta.id = pa.id;
     if (pa.id == 0) {
       ta.current = ta.worst = 0;
@@ -620,6 +759,63 @@ void dev_state::update_temp_state()
   }
 }
 
+// Risk score points of check results.  The score is halved before
+// each check, so it reflects the findings of the last few checks.
+enum {
+  risk_attr_changed  =   5, // Prefailure Attribute changed
+  risk_temp_info     =  10, // Temperature reached '-W' info limit
+  risk_attr_crit     =  20, // Attribute change reported as critical
+  risk_pending       =  20, // Pending or offline uncorrectable sectors exist
+  risk_temp_crit     =  30, // Temperature reached '-W' critical limit
+  risk_errors        =  30, // New device errors or self-test errors
+  risk_pending_incr  =  40, // Pending or offline uncorrectable sectors increased
+  risk_attr_failed   =  50, // Attribute failed now
+  risk_health_failed = 100, // SMART health check failed
+  risk_low_limit     =  10, // Devices below this score may be deferred
+  risk_max           = 1000
+};
+
+// Note changes detected by check, resets adaptive check interval ('-c i=N-M').
+static inline void mark_changed(dev_state & state)
+{
+  state.trend_changed = true;
+}
+
+// Add points to risk score of device.
+static inline void add_risk(dev_state & state, int points)
+{
+  state.risk = std::min(state.risk + points, (int)risk_max);
+  mark_changed(state);
+}
+
+// Return current check interval of device.
+static int get_checktime(const dev_config & cfg, const dev_state & state)
+{
+  if (cfg.checktime_max && state.checktime_cur)
+    return state.checktime_cur;
+  return (cfg.checktime ? cfg.checktime : checktime);
+}
+
+// Update adaptive check interval after check ('-c i=N-M'):
+// Return to minimum if changes were detected, else widen by 50%.
+static void update_checktime(const dev_config & cfg, dev_state & state)
+{
+  if (!cfg.checktime_max)
+    return;
+  int prev = get_checktime(cfg, state);
+  if (state.trend_changed)
+    state.checktime_cur = cfg.checktime;
+  else
+    state.checktime_cur = std::min(prev + prev / 2, cfg.checktime_max);
+  state.trend_changed = false;
+
+  if (debugmode && state.checktime_cur != prev)
+    PrintOut(LOG_INFO, "Device: %s, check interval %s to %d seconds (%d-%d), %s\n",
+             cfg.name.c_str(), (state.checktime_cur > prev ? "widened" : "reset"),
+             state.checktime_cur, cfg.checktime, cfg.checktime_max,
+             (state.checktime_cur > prev ? "no changes" : "changes detected"));
+}
+
 // Parse a line from a state file.
 static bool parse_dev_state_line(const char * line, persistent_dev_state & state)
 {
@@ -648,11 +844,17 @@ static bool parse_dev_state_line(const char * line, persistent_dev_state & state
        ")" // 18)
       ")" // 16)
      "|(nvme-err-log-entries)" // (24)
+     "|(ata-read-log-ext-single-sector)" // (25)
+     "|(scrub-pass-start)" // (26)
+     "|(scrub-day-start)" // (27)
+     "|(scrub-day-seconds)" // (28)
+     "|(scrub-day-sectors)" // (29)
+     "|(scrub-rate)" // (30)
      ")" // 1)
-     " *= *([0-9]+)[ \n]*$" // (25)
+     " *= *([0-9]+)[ \n]*$" // (31)
   );
 
-  const int nmatch = 1+25;
+  const int nmatch = 1+31;
   regular_expression::match_range match[nmatch];
   if (!regex.execute(line, nmatch, match))
     return false;
@@ -698,20 +900,32 @@ static bool parse_dev_state_line(const char * line, persistent_dev_state & state
     if (!(0 <= i && i < NUMBER_ATA_SMART_ATTRIBUTES))
       return false;
     if (match[m+=2].rm_so >= 0)
-      state.ata_attributes[i].id = (unsigned char)val;
+      state.ata_attributes->attr[i].id = (unsigned char)val;
     else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].val = (unsigned char)val;
+      state.ata_attributes->attr[i].val = (unsigned char)val;
     else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].worst = (unsigned char)val;
+      state.ata_attributes->attr[i].worst = (unsigned char)val;
     else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].raw = val;
+      state.ata_attributes->attr[i].raw = val;
     else if (match[++m].rm_so >= 0)
-      state.ata_attributes[i].resvd = (unsigned char)val;
+      state.ata_attributes->attr[i].resvd = (unsigned char)val;
     else
       return false;
   }
-  else if (match[m+7].rm_so >= 0)
+  else if (match[m+=7].rm_so >= 0)
     state.nvme_err_log_entries = val;
+  else if (match[++m].rm_so >= 0)
+    state.ata_log_ext_single = !!val;
+  else if (match[++m].rm_so >= 0)
+    state.scrub_pass_start = (time_t)val;
+  else if (match[++m].rm_so >= 0)
+    state.scrub_day_start = (time_t)val;
+  else if (match[++m].rm_so >= 0)
+    state.scrub_day_seconds = (unsigned)val;
+  else if (match[++m].rm_so >= 0)
+    state.scrub_day_sectors = val;
+  else if (match[++m].rm_so >= 0)
+    state.scrub_rate = val;
   else
     return false;
   return true;
@@ -790,6 +1004,11 @@ static bool write_dev_state(const char * path, const persistent_dev_state & stat
   write_dev_state_line(f, "scheduled-test-next-check", state.scheduled_test_next_check);
   write_dev_state_line(f, "selective-test-last-start", state.selective_test_last_start);
   write_dev_state_line(f, "selective-test-last-end", state.selective_test_last_end);
+  write_dev_state_line(f, "scrub-pass-start", state.scrub_pass_start);
+  write_dev_state_line(f, "scrub-day-start", state.scrub_day_start);
+  write_dev_state_line(f, "scrub-day-seconds", state.scrub_day_seconds);
+  write_dev_state_line(f, "scrub-day-sectors", state.scrub_day_sectors);
+  write_dev_state_line(f, "scrub-rate", state.scrub_rate);
 
   for (int i = 0; i < SMARTD_NMAIL; i++) {
     if (i == MAILTYPE_TEST) // Don't suppress test mails
@@ -804,9 +1023,10 @@ static bool write_dev_state(const char * path, const persistent_dev_state & stat
 
   // ATA ONLY
   write_dev_state_line(f, "ata-error-count", state.ataerrorcount);
+  write_dev_state_line(f, "ata-read-log-ext-single-sector", state.ata_log_ext_single);
 
   for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
-    const auto & pa = state.ata_attributes[i];
+    const auto & pa = state.ata_attributes->attr[i];
     if (!pa.id)
       continue;
     write_dev_state_line(f, "ata-smart-attribute", i, "id", pa.id);
@@ -838,7 +1058,7 @@ static bool write_dev_attrlog(const char * path, const dev_state & state)
              1900+tms->tm_year, 1+tms->tm_mon, tms->tm_mday,
              tms->tm_hour, tms->tm_min, tms->tm_sec);
   // ATA ONLY
-  for (const auto & pa : state.ata_attributes) {
+  for (const auto & pa : state.ata_attributes->attr) {
     if (!pa.id)
       continue;
     fprintf(f, "\t%d;%d;%" PRIu64 ";", pa.id, pa.val, pa.raw);
@@ -847,8 +1067,8 @@ static bool write_dev_attrlog(const char * path, const dev_state & state)
   const struct scsiErrorCounter * ecp;
   const char * pageNames[3] = {"read", "write", "verify"};
   for (int k = 0; k < 3; ++k) {
-    if ( !state.scsi_error_counters[k].found ) continue;
-    ecp = &state.scsi_error_counters[k].errCounter;
+    if ( !state.scsi_errors->counters[k].found ) continue;
+    ecp = &state.scsi_errors->counters[k].errCounter;
      fprintf(f, "\t%s-corr-by-ecc-fast;%" PRIu64 ";"
        "\t%s-corr-by-ecc-delayed;%" PRIu64 ";"
        "\t%s-corr-by-retry;%" PRIu64 ";"
@@ -864,8 +1084,8 @@ static bool write_dev_attrlog(const char * path, const dev_state & state)
        pageNames[k], (ecp->counter[5] / 1000000000.0),
        pageNames[k], ecp->counter[6]);
   }
-  if(state.scsi_nonmedium_error.found && state.scsi_nonmedium_error.nme.gotPC0) {
-    fprintf(f, "\tnon-medium-errors;%" PRIu64 ";", state.scsi_nonmedium_error.nme.counterPC0);
+  if(state.scsi_errors->nonmedium.found && state.scsi_errors->nonmedium.nme.gotPC0) {
+    fprintf(f, "\tnon-medium-errors;%" PRIu64 ";", state.scsi_errors->nonmedium.nme.counterPC0);
   }
   // write SCSI current temperature if it is monitored
   if (state.temperature)
@@ -1541,7 +1761,8 @@ static void Directives()
            "  -T TYPE Set the tolerance to one of: normal, permissive\n"
            "  -o VAL  Enable/disable automatic offline tests (on/off)\n"
            "  -S VAL  Enable/disable attribute autosave (on/off)\n"
-           "  -n MODE No check if: never, sleep[,N][,q], standby[,N][,q], idle[,N][,q]\n"
+           "  -n MODE No check if: never, sleep[,N][,q][,io], standby[,N][,q][,io],\n"
+           "          idle[,N][,q][,io]\n"
            "  -H      Monitor SMART Health Status, report if failed\n"
            "  -s REG  Do Self-Test at time(s) given by regular expression REG\n"
            "  -l TYPE Monitor SMART log or self-test status:\n"
@@ -1568,6 +1789,19 @@ static void Directives()
            "  -F TYPE Use firmware bug workaround:\n"
            "          %s\n"
            "  -c i=N  Set interval between disk checks to N seconds\n"
+           "  -c i=N-M Adapt interval between N and M seconds to Attribute changes\n"
+           "  -c hwmon=N Poll Temperature from Linux hwmon every N seconds\n"
+           "  -c powerpoll=N Poll I/O of devices skipped by -n every N seconds\n"
+           "  -c powerstale=N Ignore -n if last check is more than N hours ago\n"
+           "  -c testbusy=N Postpone self-tests above N I/O requests per second\n"
+           "  -c testlat=N Abort selective self-tests above N ms I/O latency\n"
+           "  -c scrub=N Scrub full disk with selective self-tests every N days\n"
+           "  -c scrubtime=N Limit scrub to N minutes of self-tests per day\n"
+           "  -c testmax=N Limit number of running self-tests on all devices\n"
+           "  -c testmaxgroup=N Limit number of running self-tests per HBA or expander\n"
+           "  -c timeout=N Set command timeout to N seconds\n"
+           "  -c logtimeout=N Set command timeout for log reads to N seconds\n"
+           "  -c quarantine=N Quarantine device after N checks with command timeouts\n"
            "   #      Comment: text after a hash sign is ignored\n"
            "   \\      Line continuation character\n"
            "Attribute ID is a decimal integer 1 <= ID <= 255\n"
@@ -1578,9 +1812,12 @@ static void Directives()
            get_valid_firmwarebug_args());
 }
 
+// Values for --long only options, see parse_options()
+enum { opt_keep_open = 1000, opt_sysfs_root, opt_cycle_budget, opt_stagger };
+
 /* Returns a pointer to a static string containing a formatted list of the valid
    arguments to the option opt or nullptr on failure. */
-static const char *GetValidArgList(char opt)
+static const char *GetValidArgList(int opt)
 {
   switch (opt) {
   case 'A':
@@ -1593,7 +1830,7 @@ static const char *GetValidArgList(char opt)
   case 'l':
     return "daemon, local0, local1, local2, local3, local4, local5, local6, local7";
   case 'q':
-    return "nodev[0], errors[,nodev0], nodev[0]startup, never, onecheck, showtests";
+    return "nodev[0], errors[,nodev0], nodev[0]startup, never, onecheck, showtests, benchmark,N";
   case 'r':
     return "ioctl[,N], ataioctl[,N], scsiioctl[,N], nvmeioctl[,N]";
   case 'p':
@@ -1601,6 +1838,12 @@ static const char *GetValidArgList(char opt)
     return "<FILE_NAME>";
   case 'i':
     return "<INTEGER_SECONDS>";
+  case opt_cycle_budget:
+    return "<INTEGER_SECONDS>";
+  case opt_stagger:
+    return "position, serial";
+  case opt_sysfs_root:
+    return "<DIR>";
 #ifdef HAVE_POSIX_API
   case 'u':
     return "<USER>[:<GROUP>], -";
@@ -1647,6 +1890,8 @@ static void Usage()
   PrintOut(LOG_INFO,"        Drop unneeded Linux process capabilities.\n"
                     "        Warning: Mail notification may not work when used.\n\n");
 #endif
+  PrintOut(LOG_INFO,"  --cycle-budget=N\n");
+  PrintOut(LOG_INFO,"        Defer low risk devices if check cycle exceeds N seconds\n\n");
   PrintOut(LOG_INFO,"  -d, --debug\n");
   PrintOut(LOG_INFO,"        Start smartd in debug mode\n\n");
   PrintOut(LOG_INFO,"  -D, --showdirectives\n");
@@ -1655,6 +1900,14 @@ static void Usage()
   PrintOut(LOG_INFO,"        Display this help and exit\n\n");
   PrintOut(LOG_INFO,"  -i N, --interval=N\n");
   PrintOut(LOG_INFO,"        Set interval between disk checks to N seconds, where N >= 10\n\n");
+  PrintOut(LOG_INFO,"  --keep-open\n");
+  PrintOut(LOG_INFO,"        Keep devices open between checks\n\n");
+  PrintOut(LOG_INFO,"  --stagger=position|serial\n");
+  PrintOut(LOG_INFO,"        Spread checks of devices over the check interval\n\n");
+#ifdef __linux__
+  PrintOut(LOG_INFO,"  --sysfs-root=DIR\n");
+  PrintOut(LOG_INFO,"        Read sysfs files below DIR instead of /sys (for testing)\n\n");
+#endif
   PrintOut(LOG_INFO,"  -l local[0-7], --logfacility=local[0-7]\n");
 #ifndef _WIN32
   PrintOut(LOG_INFO,"        Use syslog facility local0 - local7 or daemon [default]\n\n");
@@ -1720,6 +1973,25 @@ static int CloseDevice(smart_device * device, const char * name)
   return 0;
 }
 
+// Close device after registration or check unless '--keep-open' is
+// specified.  The handle is closed anyway after an error which may
+// indicate an I/O problem or device removal, so the next check reopens
+// the device.  Devices with '-d removable' are always closed to detect
+// removal before the check.
+static void close_or_keep_device(const dev_config & cfg, smart_device * device)
+{
+  const char * name = cfg.name.c_str();
+  if (keep_open && !cfg.removable) {
+    int err = device->get_errno();
+    if (!(   err == EIO || err == ENODEV || err == ENXIO || err == ENOENT
+          || err == EBADF || err == ETIMEDOUT))
+      return;
+    if (debugmode)
+      PrintOut(LOG_INFO, "Device: %s, closing device after error: %s\n", name, device->get_errmsg());
+  }
+  CloseDevice(device, name);
+}
+
 // Replace invalid characters in cfg.dev_idinfo
 static bool sanitize_dev_idinfo(std::string & s)
 {
@@ -1880,7 +2152,7 @@ static bool check_pending_id(const dev_config & cfg, const dev_state & state,
                              unsigned char id, const char * msg)
 {
   // Check attribute index
-  int i = ata_find_attr_index(id, state.smartval);
+  int i = ata_find_attr_index(id, state.ata_data->smartval);
   if (i < 0) {
     PrintOut(LOG_INFO, "Device: %s, can't monitor %s count - no Attribute %d\n",
              cfg.name.c_str(), msg, id);
@@ -1888,7 +2160,7 @@ static bool check_pending_id(const dev_config & cfg, const dev_state & state,
   }
 
   // Check value
-  uint64_t rawval = ata_get_attr_raw_value(state.smartval.vendor_attributes[i],
+  uint64_t rawval = ata_get_attr_raw_value(state.ata_data->smartval.vendor_attributes[i],
     cfg.attribute_defs);
   if (rawval >= (state.num_sectors ? state.num_sectors : 0xffffffffULL)) {
     PrintOut(LOG_INFO, "Device: %s, ignoring %s count - bogus Attribute %d value %" PRIu64 " (0x%" PRIx64 ")\n",
@@ -1933,24 +2205,19 @@ static void format_set_result_msg(std::string & msg, const char * name, bool ok,
     msg += ":on";
 }
 
-// Return true and print message if CFG.dev_idinfo is already in PREV_CFGS
-static bool is_duplicate_dev_idinfo(const dev_config & cfg, const dev_config_vector & prev_cfgs)
+// Return true and print message if CFG.dev_idinfo is already in PREV_IDS
+static bool is_duplicate_dev_idinfo(const dev_config & cfg, const dev_name_index & prev_ids)
 {
   if (!cfg.id_is_unique)
     return false;
 
-  for (const auto & prev_cfg : prev_cfgs) {
-    if (!prev_cfg.id_is_unique)
-      continue;
-    if (cfg.dev_idinfo != prev_cfg.dev_idinfo)
-      continue;
-
-    PrintOut(LOG_INFO, "Device: %s, same identity as %s, ignored\n",
-             cfg.dev_name.c_str(), prev_cfg.dev_name.c_str());
-    return true;
-  }
+  auto it = prev_ids.find(cfg.dev_idinfo);
+  if (it == prev_ids.end())
+    return false;
 
-  return false;
+  PrintOut(LOG_INFO, "Device: %s, same identity as %s, ignored\n",
+           cfg.dev_name.c_str(), it->second.c_str());
+  return true;
 }
 
 // TODO: Add '-F swapid' directive
@@ -1958,7 +2225,7 @@ const bool fix_swapped_id = false;
 
 // scan to see what ata devices there are, and if they support SMART
 static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atadev,
-                         const dev_config_vector * prev_cfgs)
+                         const dev_name_index * prev_ids)
 {
   int supported=0;
   struct ata_identify_device drive;
@@ -2007,7 +2274,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
   PrintOut(LOG_INFO, "Device: %s, %s\n", name, cfg.dev_idinfo.c_str());
 
   // Check for duplicates
-  if (prev_cfgs && is_duplicate_dev_idinfo(cfg, *prev_cfgs)) {
+  if (prev_ids && is_duplicate_dev_idinfo(cfg, *prev_ids)) {
     CloseDevice(atadev, name);
     return 1;
   }
@@ -2131,7 +2398,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
       || cfg.tempdiff        || cfg.tempinfo || cfg.tempcrit
       || cfg.curr_pending_id || cfg.offl_pending_id         ) {
 
-    if (ataReadSmartValues(atadev, &state.smartval)) {
+    if (ataReadSmartValues(atadev, &state.ata_data->smartval)) {
       PrintOut(LOG_INFO, "Device: %s, Read SMART Values failed\n", name);
       cfg.usagefailed = cfg.prefail = cfg.usage = false;
       cfg.tempdiff = cfg.tempinfo = cfg.tempcrit = 0;
@@ -2139,12 +2406,12 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
     }
     else {
       smart_val_ok = true;
-      if (ataReadSmartThresholds(atadev, &state.smartthres)) {
+      if (ataReadSmartThresholds(atadev, &state.ata_data->smartthres)) {
         PrintOut(LOG_INFO, "Device: %s, Read SMART Thresholds failed%s\n",
                  name, (cfg.usagefailed ? ", ignoring -f Directive" : ""));
         cfg.usagefailed = false;
         // Let ata_get_attr_state() return ATTRSTATE_NO_THRESHOLD:
-        memset(&state.smartthres, 0, sizeof(state.smartthres));
+        memset(&state.ata_data->smartthres, 0, sizeof(state.ata_data->smartthres));
       }
     }
 
@@ -2161,7 +2428,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
       cfg.offl_pending_id = 0;
 
     if (   (cfg.tempdiff || cfg.tempinfo || cfg.tempcrit)
-        && !ata_return_temperature_value(&state.smartval, cfg.attribute_defs)) {
+        && !ata_return_temperature_value(&state.ata_data->smartval, cfg.attribute_defs)) {
       PrintOut(LOG_INFO, "Device: %s, can't monitor Temperature, ignoring -W %d,%d,%d\n",
                name, cfg.tempdiff, cfg.tempinfo, cfg.tempcrit);
       cfg.tempdiff = cfg.tempinfo = cfg.tempcrit = 0;
@@ -2174,11 +2441,11 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
         const char * excl = (cfg.monitor_attr_flags.is_set(id,
           (opt == 'r' ? MONITOR_AS_CRIT : MONITOR_RAW_AS_CRIT)) ? "!" : "");
 
-        int idx = ata_find_attr_index(id, state.smartval);
+        int idx = ata_find_attr_index(id, state.ata_data->smartval);
         if (idx < 0)
           PrintOut(LOG_INFO,"Device: %s, no Attribute %d, ignoring -%c %d%s\n", name, id, opt, id, excl);
         else {
-          bool prefail = !!ATTRIBUTE_FLAGS_PREFAILURE(state.smartval.vendor_attributes[idx].flags);
+          bool prefail = !!ATTRIBUTE_FLAGS_PREFAILURE(state.ata_data->smartval.vendor_attributes[idx].flags);
           if (!((prefail && cfg.prefail) || (!prefail && cfg.usage)))
             PrintOut(LOG_INFO,"Device: %s, not monitoring %s Attributes, ignoring -%c %d%s\n", name,
                      (prefail ? "Prefailure" : "Usage"), opt, id, excl);
@@ -2195,7 +2462,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
       PrintOut(LOG_INFO,"Device: %s, could not %s SMART Automatic Offline Testing.\n",name, what);
     else {
       // if command appears unsupported, issue a warning...
-      if (!isSupportAutomaticTimer(&state.smartval))
+      if (!isSupportAutomaticTimer(&state.ata_data->smartval))
         PrintOut(LOG_INFO,"Device: %s, SMART Automatic Offline Testing unsupported...\n",name);
       // ... but then try anyway
       if ((cfg.autoofflinetest==1)?ataDisableAutoOffline(atadev):ataEnableAutoOffline(atadev))
@@ -2227,7 +2494,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
     int retval;
     if (!(   cfg.permissive
           || ( smart_logdir_ok && smart_logdir.entry[0x06-1].numsectors)
-          || (!smart_logdir_ok && smart_val_ok && isSmartTestLogCapable(&state.smartval, &drive)))) {
+          || (!smart_logdir_ok && smart_val_ok && isSmartTestLogCapable(&state.ata_data->smartval, &drive)))) {
       PrintOut(LOG_INFO, "Device: %s, no SMART Self-test Log, ignoring -l selftest (override with -T permissive)\n", name);
       cfg.selftest = false;
     }
@@ -2247,7 +2514,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
     int errcnt1;
     if (!(   cfg.permissive
           || ( smart_logdir_ok && smart_logdir.entry[0x01-1].numsectors)
-          || (!smart_logdir_ok && smart_val_ok && isSmartErrorLogCapable(&state.smartval, &drive)))) {
+          || (!smart_logdir_ok && smart_val_ok && isSmartErrorLogCapable(&state.ata_data->smartval, &drive)))) {
       PrintOut(LOG_INFO, "Device: %s, no SMART Error Log, ignoring -l error (override with -T permissive)\n", name);
       cfg.errorlog = false;
     }
@@ -2284,7 +2551,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
 
   // capability check: self-test and offline data collection status
   if (cfg.offlinests || cfg.selfteststs) {
-    if (!(cfg.permissive || (smart_val_ok && state.smartval.offline_data_collection_capability))) {
+    if (!(cfg.permissive || (smart_val_ok && state.ata_data->smartval.offline_data_collection_capability))) {
       if (cfg.offlinests)
         PrintOut(LOG_INFO, "Device: %s, no SMART Offline Data Collection capability, ignoring -l offlinests (override with -T permissive)\n", name);
       if (cfg.selfteststs)
@@ -2379,7 +2646,7 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
   PrintOut(LOG_INFO,"Device: %s, is SMART capable. Adding to \"monitor\" list.\n",name);
   
   // close file descriptor
-  CloseDevice(atadev, name);
+  close_or_keep_device(cfg, atadev);
 
   if (!state_path_prefix.empty() || !attrlog_path_prefix.empty()) {
     // Build file name for state file
@@ -2392,6 +2659,9 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
         PrintOut(LOG_INFO, "Device: %s, state read from %s\n", name, cfg.state_file.c_str());
         // Copy ATA attribute values to temp state
         state.update_temp_state();
+        // Avoid multi-sector READ LOG EXT if it failed before
+        if (state.ata_log_ext_single)
+          atadev->set_single_sector_log_ext();
       }
     }
     if (!attrlog_path_prefix.empty())
@@ -2403,15 +2673,18 @@ static int ATADeviceScan(dev_config & cfg, dev_state & state, ata_device * atade
   return 0;
 }
 
+// Supported SCSI log and VPD pages, kept across config reloads.
+// Key is device name and INQUIRY vendor, product and revision.
+static std::map<std::string, scsi_page_support> scsi_page_support_cache;
+
 // on success, return 0. On failure, return >0.  Never return <0,
 // please.
 static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scsidev,
-                          const dev_config_vector * prev_cfgs)
+                          const dev_name_index * prev_ids)
 {
   int err, req_len, avail_len, version, len;
   const char *device = cfg.name.c_str();
   struct scsi_iec_mode_page iec;
-  uint8_t  tBuf[64];
   uint8_t  inqBuf[96];
   uint8_t  vpdBuf[252];
   char lu_id[64], serial[256], vendor[40], model[40];
@@ -2455,6 +2728,14 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
     return 2;
   }
 
+  // Reuse supported pages from previous registration of the same device
+  std::string page_support_key = cfg.name + '\n' + std::string((const char *)inqBuf + 8, 28);
+  {
+    auto it = scsi_page_support_cache.find(page_support_key);
+    if (it != scsi_page_support_cache.end())
+      scsidev->page_support() = it->second;
+  }
+
   if (supported_vpd_pages_p) {
     delete supported_vpd_pages_p;
     supported_vpd_pages_p = nullptr;
@@ -2503,7 +2784,7 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
   PrintOut(LOG_INFO, "Device: %s, %s\n", device, cfg.dev_idinfo.c_str());
 
   // Check for duplicates
-  if (prev_cfgs && is_duplicate_dev_idinfo(cfg, *prev_cfgs)) {
+  if (prev_ids && is_duplicate_dev_idinfo(cfg, *prev_ids)) {
     CloseDevice(scsidev, device);
     return 1;
   }
@@ -2553,34 +2834,14 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
   
   // Flag that certain log pages are supported (information may be
   // available from other sources).
-  if (0 == scsiLogSense(scsidev, SUPPORTED_LPAGES, 0, tBuf, sizeof(tBuf), 0) ||
-      0 == scsiLogSense(scsidev, SUPPORTED_LPAGES, 0, tBuf, sizeof(tBuf), 68))
-      /* workaround for the bug #678 on ST8000NM0075/E001. Up to 64 pages + 4b header */
-  {
-    for (int k = 4; k < tBuf[3] + LOGPAGEHDRSIZE; ++k) {
-      switch (tBuf[k]) { 
-      case TEMPERATURE_LPAGE:
-        state.TempPageSupported = 1;
-        break;
-      case IE_LPAGE:
-        state.SmartPageSupported = 1;
-        break;
-      case READ_ERROR_COUNTER_LPAGE:
-        state.ReadECounterPageSupported = 1;
-        break;
-      case WRITE_ERROR_COUNTER_LPAGE:
-        state.WriteECounterPageSupported = 1;
-        break;
-      case VERIFY_ERROR_COUNTER_LPAGE:
-        state.VerifyECounterPageSupported = 1;
-        break;
-      case NON_MEDIUM_ERROR_LPAGE:
-        state.NonMediumErrorPageSupported = 1;
-        break;
-      default:
-        break;
-      }
-    }   
+  if (!scsiReadSupportedLogPages(scsidev, false)) {
+    const scsi_page_support & ps = scsidev->page_support();
+    state.TempPageSupported = ps.is_log_page_supported(TEMPERATURE_LPAGE);
+    state.SmartPageSupported = ps.is_log_page_supported(IE_LPAGE);
+    state.ReadECounterPageSupported = ps.is_log_page_supported(READ_ERROR_COUNTER_LPAGE);
+    state.WriteECounterPageSupported = ps.is_log_page_supported(WRITE_ERROR_COUNTER_LPAGE);
+    state.VerifyECounterPageSupported = ps.is_log_page_supported(VERIFY_ERROR_COUNTER_LPAGE);
+    state.NonMediumErrorPageSupported = ps.is_log_page_supported(NON_MEDIUM_ERROR_LPAGE);
   }
   
   // Check if scsiCheckIE() is going to work
@@ -2642,8 +2903,11 @@ static int SCSIDeviceScan(dev_config & cfg, dev_state & state, scsi_device * scs
   // Make sure that init_standby_check() ignores SCSI devices
   cfg.offlinests_ns = cfg.selfteststs_ns = false;
 
+  // Remember supported pages for next config reload
+  scsi_page_support_cache[page_support_key] = scsidev->page_support();
+
   // close file descriptor
-  CloseDevice(scsidev, device);
+  close_or_keep_device(cfg, scsidev);
 
   if (!state_path_prefix.empty() || !attrlog_path_prefix.empty()) {
     // Build file name for state file
@@ -2753,6 +3017,7 @@ static bool check_nvme_error_log(const dev_config & cfg, dev_state & state, nvme
   else {
     PrintOut(LOG_CRIT, "%s\n", msg.c_str());
     MailWarning(cfg, state, 4, "%s", msg.c_str());
+    add_risk(state, risk_errors);
   }
 
   state.nvme_err_log_entries = newcnt;
@@ -2761,7 +3026,7 @@ static bool check_nvme_error_log(const dev_config & cfg, dev_state & state, nvme
 }
 
 static int NVMeDeviceScan(dev_config & cfg, dev_state & state, nvme_device * nvmedev,
-                          const dev_config_vector * prev_cfgs)
+                          const dev_name_index * prev_ids)
 {
   const char *name = cfg.name.c_str();
 
@@ -2798,7 +3063,7 @@ static int NVMeDeviceScan(dev_config & cfg, dev_state & state, nvme_device * nvm
   PrintOut(LOG_INFO, "Device: %s, %s\n", name, cfg.dev_idinfo.c_str());
 
   // Check for duplicates
-  if (prev_cfgs && is_duplicate_dev_idinfo(cfg, *prev_cfgs)) {
+  if (prev_ids && is_duplicate_dev_idinfo(cfg, *prev_ids)) {
     CloseDevice(nvmedev, name);
     return 1;
   }
@@ -2844,7 +3109,7 @@ static int NVMeDeviceScan(dev_config & cfg, dev_state & state, nvme_device * nvm
   // Make sure that init_standby_check() ignores NVMe devices
   cfg.offlinests_ns = cfg.selfteststs_ns = false;
 
-  CloseDevice(nvmedev, name);
+  close_or_keep_device(cfg, nvmedev);
 
   if (!state_path_prefix.empty()) {
     // Build file name for state file
@@ -2864,6 +3129,215 @@ static int NVMeDeviceScan(dev_config & cfg, dev_state & state, nvme_device * nvm
   return 0;
 }
 
+#ifdef __linux__
+
+// Return kernel name of device: "/dev/disk/by-id/..." -> "/dev/sdX" -> "sdX"
+static std::string get_sysfs_dev_name(const dev_config & cfg)
+{
+  std::string name = cfg.dev_name;
+  char * rp = realpath(name.c_str(), nullptr);
+  if (rp) {
+    name = rp;
+    free(rp);
+  }
+  std::string::size_type i = name.rfind('/');
+  if (i != std::string::npos)
+    name.erase(0, i + 1);
+  return name;
+}
+
+// Return "/sys/block/NAME/stat" if readable, else empty string.
+static std::string get_io_stat_file(const dev_config & cfg)
+{
+  std::string name = get_sysfs_dev_name(cfg);
+  if (name.empty())
+    return "";
+  std::string file = sysfs_root + "/block/" + name + "/stat";
+  if (access(file.c_str(), R_OK))
+    return "";
+  return file;
+}
+
+// Read completed read, write, discard and flush requests, their total
+// time and requests in flight from a 'stat' file.
+// Pass-through commands from smartd are not counted by the kernel.
+static bool read_io_stat(const std::string & file, io_stat_sample & sample)
+{
+  sample = io_stat_sample();
+  FILE * f = fopen(file.c_str(), "r");
+  if (!f)
+    return false;
+  uint64_t v[17] = {0, };
+  int n = fscanf(f, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                    " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                    " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                    " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+                    " %" SCNu64,
+                 &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8],
+                 &v[9], &v[10], &v[11], &v[12], &v[13], &v[14], &v[15], &v[16]);
+  fclose(f);
+  if (n < 11)
+    return false;
+  // Fields: 0/3 reads/ticks, 4/7 writes/ticks, 8 in flight,
+  // 11/14 discards/ticks, 15/16 flushes/ticks
+  sample.ios = v[0] + v[4] + v[11] + v[15];
+  sample.ticks = v[3] + v[7] + v[14] + v[16];
+  sample.inflight = v[8];
+  sample.time = time(nullptr);
+  return true;
+}
+
+// Return topology group for '-c testmaxgroup=N': the nearest SAS expander
+// ("expander-H:N") or else the SCSI host ("hostH") in the sysfs device
+// path, empty if none.
+static std::string get_test_group(const dev_config & cfg)
+{
+  std::string name = get_sysfs_dev_name(cfg);
+  if (name.empty())
+    return "";
+  char * rp = realpath((sysfs_root + "/block/" + name + "/device").c_str(), nullptr);
+  if (!rp)
+    return "";
+  std::string path = rp;
+  free(rp);
+
+  std::string expander, host;
+  for (std::string::size_type i = 0; i < path.size(); ) {
+    std::string::size_type j = path.find('/', i);
+    if (j == std::string::npos)
+      j = path.size();
+    std::string comp = path.substr(i, j - i);
+    if (str_starts_with(comp, "expander-"))
+      expander = comp;
+    else if (str_starts_with(comp, "host") && comp.size() > 4 && isdigit((unsigned char)comp[4]))
+      host = comp;
+    i = j + 1;
+  }
+  return (!expander.empty() ? expander : host);
+}
+
+#else // __linux__
+
+static inline std::string get_io_stat_file(const dev_config & /*cfg*/)
+{
+  return "";
+}
+
+static inline bool read_io_stat(const std::string & /*file*/, io_stat_sample & sample)
+{
+  sample = io_stat_sample();
+  return false;
+}
+
+static inline std::string get_test_group(const dev_config & /*cfg*/)
+{
+  return "";
+}
+
+#endif // __linux__
+
+// Return sum of I/O requests done and in flight, 0 on error.
+static uint64_t read_io_count(const std::string & file)
+{
+  io_stat_sample sample;
+  if (!read_io_stat(file, sample))
+    return 0;
+  return 1 + sample.ios + sample.inflight;
+}
+
+// Set up I/O statistics for '-n ...,io', '-c powerpoll=N' and
+// '-c testbusy/testlat=N'
+static void init_io_stat(dev_config & cfg, dev_state & state)
+{
+  // '-c powerpoll=N' implies '-n ...,io'
+  if (cfg.powermode && cfg.powerpoll)
+    cfg.powerio = true;
+  if (!((cfg.powermode && cfg.powerio) || cfg.testbusy || cfg.testlat))
+    return;
+  state.io_stat_file = get_io_stat_file(cfg);
+  if (state.io_stat_file.empty())
+    PrintOut(LOG_INFO, "Device: %s, no I/O statistics found, '%s' ignored\n",
+             cfg.name.c_str(), (cfg.powerio ? "-n ...,io" : "-c test...=N"));
+}
+
+// Set up topology group for '-c testmaxgroup=N'
+static void init_test_group(const dev_config & cfg, dev_state & state)
+{
+  if (!cfg.testmaxgroup)
+    return;
+  state.test_group = get_test_group(cfg);
+  if (state.test_group.empty())
+    PrintOut(LOG_INFO, "Device: %s, no SCSI host or SAS expander found, '-c testmaxgroup' ignored\n",
+             cfg.name.c_str());
+  else if (debugmode)
+    PrintOut(LOG_INFO, "Device: %s, self-test group %s\n", cfg.name.c_str(),
+             state.test_group.c_str());
+}
+
+// Update I/O rate and latency since last check ('-c testbusy/testlat=N').
+// These are sampled at each check, so the values are averages over the
+// check interval.
+static void update_io_load(const dev_config & cfg, dev_state & state)
+{
+  state.io_rate = state.io_latency = -1;
+  if (state.io_stat_file.empty() || !(cfg.testbusy || cfg.testlat))
+    return;
+  io_stat_sample prev = state.io_sample;
+  if (!read_io_stat(state.io_stat_file, state.io_sample) || !prev.time)
+    return;
+  const io_stat_sample & curr = state.io_sample;
+  if (!(curr.time > prev.time && curr.ios >= prev.ios && curr.ticks >= prev.ticks))
+    return;
+  uint64_t ios = curr.ios - prev.ios, ticks = curr.ticks - prev.ticks;
+  state.io_rate = (double)ios / (curr.time - prev.time);
+  state.io_latency = (ios ? (double)ticks / ios : 0);
+
+  if (state.test_running) {
+    state.test_io_ios += ios;
+    state.test_io_ticks += ticks;
+  }
+  else if (ios)
+    state.io_latency_idle = state.io_latency;
+
+  if (debugmode)
+    PrintOut(LOG_INFO, "Device: %s, %.1f I/O requests/s, %.1f ms mean latency since last check\n",
+             cfg.name.c_str(), state.io_rate, state.io_latency);
+}
+
+// Return true if another check may be skipped due to power mode.
+// Limits are the number of skipped checks ('-n MODE,N') and the time
+// since the last check which was not skipped ('-c powerstale=N').
+static bool power_skip_allowed(const dev_config & cfg, dev_state & state)
+{
+  if (cfg.powerskipmax && state.powerskipcnt >= cfg.powerskipmax)
+    return false;
+  if (cfg.powerstale) {
+    time_t now = time(nullptr);
+    if (!state.power_lastcheck)
+      state.power_lastcheck = now;
+    else if (now - state.power_lastcheck >= cfg.powerstale * 3600L)
+      return false;
+  }
+  return true;
+}
+
+// Update I/O count and return true if device had no I/O since
+// last check ('-n ...,io').
+static bool no_io_since_last_check(const dev_config & cfg, dev_state & state)
+{
+  state.io_active = false;
+  if (!cfg.powerio || state.io_stat_file.empty())
+    return false;
+  uint64_t count = read_io_count(state.io_stat_file);
+  bool unchanged = (count && count == state.io_count);
+  state.io_active = (count && state.io_count && count != state.io_count);
+  state.io_count = count;
+  if (debugmode)
+    PrintOut(LOG_INFO, "Device: %s, %s since last check\n", cfg.name.c_str(),
+             (unchanged ? "no I/O" : state.io_active ? "I/O" : "unknown I/O"));
+  return unchanged;
+}
+
 // Open device for next check, return false on error
 static bool open_device(const dev_config & cfg, dev_state & state, smart_device * device,
                         const char * type)
@@ -2879,12 +3353,25 @@ static bool open_device(const dev_config & cfg, dev_state & state, smart_device
   // power mode first before opening the device for full access,
   // and exit without check if disk is reported in standby.
   if (device->is_ata() && cfg.powermode && !state.powermodefail && !state.removed) {
+    // With '-n ...,io', a device which was skipped at last check and had
+    // no I/O since is still in low-power mode.  Skip without any command.
+    bool no_io = no_io_since_last_check(cfg, state);
+    if (no_io && state.powerskipcnt) {
+      if (power_skip_allowed(cfg, state)) {
+        if (debugmode)
+          PrintOut(LOG_INFO, "Device: %s, no I/O since last check, still suspending checks\n",
+                   name);
+        state.powerskipcnt++;
+        return false;
+      }
+    }
+
     // Note that 'is_powered_down()' handles opening the device itself, and
     // can be used before calling 'open()' (that's the whole point of 'is_powered_down()'!).
     if (device->is_powered_down())
     {
-      // skip at most powerskipmax checks
-      if (!cfg.powerskipmax || state.powerskipcnt<cfg.powerskipmax) {
+      // skip at most powerskipmax checks or until powerstale limit
+      if (power_skip_allowed(cfg, state)) {
         // report first only except if state has changed, avoid waking up system disk
         if ((!state.powerskipcnt || state.lastpowermodeskipped != -1) && !cfg.powerquiet) {
           PrintOut(LOG_INFO, "Device: %s, is in %s mode, suspending checks\n", name, "STANDBY (OS)");
@@ -2898,6 +3385,14 @@ static bool open_device(const dev_config & cfg, dev_state & state, smart_device
 
   // if we can't open device, fail gracefully rather than hard --
   // perhaps the next time around we'll be able to open it
+  // Reuse handle from previous check if '--keep-open' is specified
+  if (device->is_open()) {
+    if (debugmode)
+      PrintOut(LOG_INFO, "Device: %s, reusing open %s device\n", name, type);
+    device->clear_err();
+    return true;
+  }
+
   if (!device->open()) {
     // For removable devices, print error message only once and suppress email
     if (!cfg.removable) {
@@ -2916,7 +3411,8 @@ static bool open_device(const dev_config & cfg, dev_state & state, smart_device
   if (debugmode)
     PrintOut(LOG_INFO,"Device: %s, opened %s device\n", name, type);
 
-  if (!cfg.removable)
+  // Type 9 mail is also used for quarantine, see check_cmd_timeouts()
+  if (!cfg.removable && !state.quarantined)
     reset_warning_mail(cfg, state, 9, "open of %s device worked again", type);
   else if (state.removed) {
     PrintOut(LOG_INFO, "Device: %s, reconnected %s device\n", name, type);
@@ -2950,6 +3446,7 @@ static void CheckSelfTestLogs(const dev_config & cfg, dev_state & state, int new
       // increase in error count
       PrintOut(LOG_CRIT, "Device: %s, Self-Test Log error count increased from %d to %d\n",
                name, oldc, newc);
+      add_risk(state, risk_errors);
       MailWarning(cfg, state, 3, "Device: %s, Self-Test Log error count increased from %d to %d",
                    name, oldc, newc);
       state.must_write = true;
@@ -2964,6 +3461,7 @@ static void CheckSelfTestLogs(const dev_config & cfg, dev_state & state, int new
       // new failure.
       PrintOut(LOG_CRIT, "Device: %s, new Self-Test Log error at hour timestamp %d\n",
                name, newh);
+      add_risk(state, risk_errors);
       MailWarning(cfg, state, 3, "Device: %s, new Self-Test Log error at hour timestamp %d",
                    name, newh);
       state.must_write = true;
@@ -3122,6 +3620,22 @@ static void PrintTestSchedule(const dev_config_vector & configs, dev_state_vecto
     return;
   std::vector<int> testcnts(numdev * num_test_types, 0);
 
+  PrintOut(LOG_INFO, "\nCheck intervals:\n");
+  for (unsigned i = 0; i < numdev; i++) {
+    const dev_config & cfg = configs.at(i);
+    int ct = get_checktime(cfg, states.at(i));
+    std::string phase;
+    if (stagger_mode)
+      phase = strprintf(", phase +%d seconds", (int)(((uint64_t)states.at(i).phase * ct) >> 32));
+    if (!cfg.checktime_max)
+      PrintOut(LOG_INFO, "Device: %s, check every %d seconds%s\n", cfg.name.c_str(),
+               ct, phase.c_str());
+    else
+      PrintOut(LOG_INFO, "Device: %s, check every %d-%d seconds, now %d, "
+               "+50%% after each check without changes%s\n", cfg.name.c_str(),
+               cfg.checktime, cfg.checktime_max, ct, phase.c_str());
+  }
+
   PrintOut(LOG_INFO, "\nNext scheduled self tests (at most 5 of each type per device):\n");
 
   // FixGlibcTimeZoneBug(); // done in PrintOut()
@@ -3167,6 +3681,294 @@ static void PrintTestSchedule(const dev_config_vector & configs, dev_state_vecto
 
 }
 
+// Postpone scheduled self-test if foreground I/O rate or latency is above
+// the limit ('-c testbusy=N', '-c testlat=N').  Return the test to start
+// now, 0 if none.
+static char postpone_test_if_busy(const dev_config & cfg, dev_state & state, char testtype)
+{
+  const char * name = cfg.name.c_str();
+  if (!testtype) {
+    if (!state.test_postponed)
+      return 0;
+    // Give up if postponed for one day
+    if (state.test_postponed_time + 3600L*24 <= time(nullptr)) {
+      PrintOut(LOG_INFO, "Device: %s, postponed %c self-test dropped after one day of %s\n",
+               name, state.test_postponed, (state.test_queued ? "waiting" : "I/O load"));
+      state.test_postponed = 0;
+      state.test_queued = state.test_slot_reserved = false;
+      return 0;
+    }
+    testtype = state.test_postponed;
+  }
+
+  // Selective self-tests are also postponed if the latency limit is exceeded
+  if (   (cfg.testbusy && state.io_rate > cfg.testbusy)
+      || (cfg.testlat && state.io_latency > cfg.testlat && strchr("cnr", testtype))) {
+    if (state.test_postponed != testtype) {
+      PrintOut(LOG_INFO, "Device: %s, %.1f I/O requests/s, %.1f ms latency, postponing scheduled %c self-test\n",
+               name, state.io_rate, state.io_latency, testtype);
+      state.test_postponed = testtype;
+      state.test_postponed_time = time(nullptr);
+    }
+    return 0;
+  }
+
+  if (state.test_postponed == testtype && !state.test_queued && debugmode)
+    PrintOut(LOG_INFO, "Device: %s, starting postponed %c self-test\n", name, testtype);
+  state.test_postponed = 0;
+  return testtype;
+}
+
+// Number of running or reserved self-tests per topology group and
+// for all devices ("") in current check cycle ('-c testmax[group]=N').
+static std::unordered_map<std::string, int> test_slots_used;
+
+// Return true if a self-test is running on the device.
+static bool is_test_running(const dev_state & state)
+{
+  return (   state.test_running
+          || (state.ata_data.allocated() && (state.ata_data->smartval.self_test_exec_status >> 4) == 15));
+}
+
+// Return true if a test slot is free for device ('-c testmax[group]=N').
+static bool test_slot_free(const dev_config & cfg, const dev_state & state)
+{
+  if (cfg.testmax && test_slots_used[""] >= cfg.testmax)
+    return false;
+  if (cfg.testmaxgroup && !state.test_group.empty()
+      && test_slots_used[state.test_group] >= cfg.testmaxgroup)
+    return false;
+  return true;
+}
+
+static void use_test_slot(const dev_state & state)
+{
+  test_slots_used[""]++;
+  if (!state.test_group.empty())
+    test_slots_used[state.test_group]++;
+}
+
+// Count running self-tests at start of check cycle and reserve free slots
+// for queued tests in order of their queue time ('-c testmax[group]=N').
+static void init_test_slots(const dev_config_vector & configs, dev_state_vector & states)
+{
+  test_slots_used.clear();
+  std::vector<unsigned> queued;
+  for (unsigned i = 0; i < states.size(); i++) {
+    dev_state & state = states[i];
+    state.test_slot_reserved = false;
+    if (is_test_running(state))
+      use_test_slot(state);
+    else if (state.test_queued)
+      queued.push_back(i);
+  }
+  if (queued.empty())
+    return;
+
+  std::stable_sort(queued.begin(), queued.end(),
+    [&states](unsigned a, unsigned b) {
+      return (states[a].test_postponed_time < states[b].test_postponed_time);
+    }
+  );
+  int running = test_slots_used[""];
+  for (unsigned n = 0; n < queued.size(); n++) {
+    const dev_config & cfg = configs[queued[n]];
+    dev_state & state = states[queued[n]];
+    if (test_slot_free(cfg, state)) {
+      use_test_slot(state);
+      state.test_slot_reserved = true;
+    }
+    if (debugmode)
+      PrintOut(LOG_INFO, "Device: %s, %c self-test queued [%u/%u]%s%s, %s\n", cfg.name.c_str(),
+               state.test_postponed, n + 1, (unsigned)queued.size(),
+               (!state.test_group.empty() ? " in group " : ""), state.test_group.c_str(),
+               (state.test_slot_reserved ? "slot reserved" : "waiting"));
+  }
+  if (debugmode)
+    PrintOut(LOG_INFO, "Self-tests: %d running, %u queued\n", running, (unsigned)queued.size());
+}
+
+// Queue scheduled self-test if the number of running self-tests reached
+// the limit ('-c testmax[group]=N').  Return the test to start now, 0 if none.
+static char queue_test_if_limited(const dev_config & cfg, dev_state & state, char testtype)
+{
+  if (testtype == 'O')
+    return testtype; // Offline data collection is not limited
+
+  if (state.test_slot_reserved) {
+    // Queued test got a slot at start of cycle
+    state.test_slot_reserved = state.test_queued = false;
+    return testtype;
+  }
+  if (!state.test_queued && test_slot_free(cfg, state)) {
+    use_test_slot(state);
+    return testtype;
+  }
+
+  if (!state.test_queued) {
+    bool all = (cfg.testmax && test_slots_used[""] >= cfg.testmax);
+    if (all)
+      PrintOut(LOG_INFO, "Device: %s, %d self-tests running (limit %d), queuing scheduled %c self-test\n",
+               cfg.name.c_str(), test_slots_used[""], cfg.testmax, testtype);
+    else
+      PrintOut(LOG_INFO, "Device: %s, %d self-tests running in group %s (limit %d), "
+               "queuing scheduled %c self-test\n", cfg.name.c_str(),
+               test_slots_used[state.test_group], state.test_group.c_str(),
+               cfg.testmaxgroup, testtype);
+    state.test_queued = true;
+    state.test_postponed_time = time(nullptr);
+  }
+  state.test_postponed = testtype;
+  return 0;
+}
+
+// Account test time of a finished or aborted scrub span ('-c scrub=N')
+// and report progress of the current pass.
+static void finish_scrub_span(const dev_config & cfg, dev_state & state, bool completed)
+{
+  if (!state.scrub_test_start)
+    return;
+  time_t now = time(nullptr);
+  // Test end is detected at next check, so the rate is a lower bound
+  unsigned elapsed = (now > state.scrub_test_start ? (unsigned)(now - state.scrub_test_start) : 1);
+  state.scrub_test_start = 0;
+  state.scrub_day_seconds += elapsed;
+  state.must_write = true;
+  if (!completed)
+    return;
+
+  const char * name = cfg.name.c_str();
+  uint64_t start = state.selective_test_last_start, end = state.selective_test_last_end;
+  uint64_t sectors = end - start + 1;
+  state.scrub_day_sectors += sectors;
+  uint64_t rate = sectors / elapsed;
+  if (rate)
+    state.scrub_rate = (state.scrub_rate ? (state.scrub_rate + rate) / 2 : rate);
+
+  unsigned days = (unsigned)((now - state.scrub_pass_start) / (3600L*24));
+  if (end + 1 >= state.num_sectors) {
+    PrintOut(LOG_INFO, "Device: %s, scrub pass completed after %u day%s\n",
+             name, days, (days == 1 ? "" : "s"));
+    state.scrub_pass_start = 0;
+    return;
+  }
+  PrintOut(LOG_INFO, "Device: %s, scrub pass %u%% complete after %u of %d days, "
+           "%" PRIu64 " sectors/s\n", name,
+           (unsigned)(100 * (end + 1) / state.num_sectors), days, cfg.scrubdays,
+           state.scrub_rate);
+}
+
+// Report foreground I/O and scrub progress of a finished self-test and
+// abort a running selective self-test if I/O latency is above the limit
+// ('-c testlat=N').  The remaining span is redone later.
+static void check_test_io_load(const dev_config & cfg, dev_state & state, ata_device * device)
+{
+  if (!state.test_running)
+    return;
+  const char * name = cfg.name.c_str();
+
+  if ((state.ata_data->smartval.self_test_exec_status >> 4) != 15) {
+    // Test finished, report overhead
+    if (state.test_io_ios && state.io_latency_idle >= 0)
+      PrintOut(LOG_INFO, "Device: %s, %c self-test finished, I/O latency %.1f ms "
+               "(%.1f ms without test), %" PRIu64 " requests\n", name, state.test_running,
+               (double)state.test_io_ticks / state.test_io_ios, state.io_latency_idle,
+               state.test_io_ios);
+    finish_scrub_span(cfg, state, !(state.ata_data->smartval.self_test_exec_status >> 4));
+    state.test_running = 0;
+    state.test_io_ios = state.test_io_ticks = 0;
+    return;
+  }
+
+  if (!(   cfg.testlat && state.io_latency > cfg.testlat
+        && strchr("cnr", state.test_running)))
+    return;
+
+  // Remember current LBA to resume from there
+  ata_selective_self_test_log log;
+  uint64_t resume = 0;
+  if (!ataReadSelectiveSelfTestLog(device, &log)) {
+    resume = log.currentlba;
+    if (!(   state.selective_test_last_start <= resume
+          && resume <= state.selective_test_last_end))
+      resume = 0;
+  }
+
+  if (smartcommandhandler(device, IMMEDIATE_OFFLINE, ABORT_SELF_TEST, nullptr)) {
+    PrintOut(LOG_CRIT, "Device: %s, abort of Selective Self-Test failed\n", name);
+    return;
+  }
+  PrintOut(LOG_INFO, "Device: %s, I/O latency %.1f ms (limit %d ms), "
+           "aborted Selective Self-Test at LBA %" PRIu64 "\n", name, state.io_latency,
+           cfg.testlat, resume);
+  if (resume) {
+    state.selective_test_last_start = resume;
+    state.test_resume = true;
+    state.must_write = true;
+  }
+  finish_scrub_span(cfg, state, false);
+  // Redo remaining span later
+  state.test_postponed = 'r';
+  state.test_postponed_time = time(nullptr);
+  state.test_running = 0;
+  state.test_io_ios = state.test_io_ticks = 0;
+}
+
+// Return the size of the next selective scrub span ('-c scrub=N'), 0 if
+// the daily time budget is used up or the daily share of the pass is
+// already tested.  The span is sized from the sectors left in the current
+// pass, the days left in the coverage period and the measured test rate.
+static uint64_t get_scrub_span_size(const dev_config & cfg, dev_state & state, uint64_t next_lba)
+{
+  const char * name = cfg.name.c_str();
+  time_t now = time(nullptr);
+  const long day = 3600L*24;
+  if (!next_lba || !state.scrub_pass_start) {
+    if (!next_lba || debugmode)
+      PrintOut(LOG_INFO, "Device: %s, starting new scrub pass at LBA %" PRIu64 ", "
+               "target %d days\n", name, next_lba, cfg.scrubdays);
+    state.scrub_pass_start = now;
+  }
+  if (!(state.scrub_day_start <= now && now < state.scrub_day_start + day)) {
+    state.scrub_day_start = now;
+    state.scrub_day_seconds = 0;
+    state.scrub_day_sectors = 0;
+  }
+  state.must_write = true;
+
+  unsigned budget = (cfg.scrubtime ? cfg.scrubtime : 60) * 60;
+  if (state.scrub_day_seconds >= budget) {
+    PrintOut(LOG_INFO, "Device: %s, daily scrub time of %u minutes used, "
+             "skipping scheduled Selective Self-Test\n", name, budget / 60);
+    return 0;
+  }
+
+  // Distribute sectors left at start of today over the days left
+  uint64_t left = state.num_sectors - next_lba + state.scrub_day_sectors;
+  time_t pass_end = state.scrub_pass_start + cfg.scrubdays * day;
+  uint64_t days_left = (pass_end > state.scrub_day_start
+                        ? (pass_end - state.scrub_day_start + day-1) / day : 1);
+  uint64_t today = (left + days_left-1) / days_left;
+  if (today <= state.scrub_day_sectors) {
+    if (debugmode)
+      PrintOut(LOG_INFO, "Device: %s, daily scrub share of %" PRIu64 " sectors done, "
+               "skipping scheduled Selective Self-Test\n", name, today);
+    return 0;
+  }
+  uint64_t size = today - state.scrub_day_sectors;
+
+  // Limit to remaining time budget, assume 50 MB/s until rate is measured
+  uint64_t rate = (state.scrub_rate ? state.scrub_rate : 100000);
+  uint64_t max_size = rate * (budget - state.scrub_day_seconds);
+  if (size > max_size) {
+    PrintOut(LOG_INFO, "Device: %s, scrub span limited to %" PRIu64 " of %" PRIu64 " sectors "
+             "by daily scrub time, pass may exceed %d days\n", name, max_size, size,
+             cfg.scrubdays);
+    size = max_size;
+  }
+  return size;
+}
+
 // Return zero on success, nonzero on failure. Perform offline (background)
 // short or long (extended) self test on given scsi device.
 static int DoSCSISelfTest(const dev_config & cfg, dev_state & state, scsi_device * device, char testtype)
@@ -3222,7 +4024,7 @@ static int DoSCSISelfTest(const dev_config & cfg, dev_state & state, scsi_device
   }
   
   PrintOut(LOG_INFO, "Device: %s, starting scheduled %s-Test.\n", name, testname);
-  
+  state.test_running = testtype;
   return 0;
 }
 
@@ -3308,8 +4110,31 @@ static int DoATASelfTest(const dev_config & cfg, dev_state & state, ata_device *
   if (dotest == SELECTIVE_SELF_TEST) {
     // Set test span
     ata_selective_selftest_args selargs, prev_args;
+    bool scrub_next = false;
     selargs.num_spans = 1;
     selargs.span[0].mode = mode;
+    if (testtype == 'r' && state.test_resume) {
+      // Resume aborted test, see check_test_io_load()
+      selargs.span[0].mode = SEL_RANGE;
+      selargs.span[0].start = state.selective_test_last_start;
+      selargs.span[0].end   = state.selective_test_last_end;
+    }
+    else if (   cfg.scrubdays
+             && (testtype == 'n' || (testtype == 'c' && !(   (data.self_test_exec_status >> 4) == 1
+                                                          || (data.self_test_exec_status >> 4) == 2)))) {
+      // Next span of scrub pass, 'c' redoes aborted span as usual
+      uint64_t next = state.selective_test_last_end + 1;
+      if (!state.selective_test_last_end || next >= state.num_sectors)
+        next = 0;
+      uint64_t size = get_scrub_span_size(cfg, state, next);
+      if (!size)
+        return 1;
+      selargs.span[0].mode = SEL_RANGE;
+      selargs.span[0].start = next;
+      selargs.span[0].end = (size < state.num_sectors - next ? next + size : state.num_sectors) - 1;
+      scrub_next = true;
+    }
+    state.test_resume = false;
     prev_args.num_spans = 1;
     prev_args.span[0].start = state.selective_test_last_start;
     prev_args.span[0].end   = state.selective_test_last_end;
@@ -3319,7 +4144,7 @@ static int DoATASelfTest(const dev_config & cfg, dev_state & state, ata_device *
     }
     uint64_t start = selargs.span[0].start, end = selargs.span[0].end;
     PrintOut(LOG_INFO, "Device: %s, %s test span at LBA %" PRIu64 " - %" PRIu64 " (%" PRIu64 " sectors, %u%% - %u%% of disk).\n",
-      name, (selargs.span[0].mode == SEL_NEXT ? "next" : "redo"),
+      name, (selargs.span[0].mode == SEL_NEXT || scrub_next ? "next" : "redo"),
       start, end, end - start + 1,
       (unsigned)((100 * start + state.num_sectors/2) / state.num_sectors),
       (unsigned)((100 * end   + state.num_sectors/2) / state.num_sectors));
@@ -3338,8 +4163,12 @@ static int DoATASelfTest(const dev_config & cfg, dev_state & state, ata_device *
   // and force log of next test status
   if (testtype == 'O')
     state.offline_started = true;
-  else
+  else {
     state.selftest_started = true;
+    state.test_running = testtype;
+    if (dotest == SELECTIVE_SELF_TEST && cfg.scrubdays)
+      state.scrub_test_start = time(nullptr);
+  }
 
   PrintOut(LOG_INFO, "Device: %s, starting scheduled %sTest.\n", name, testname);
   return 0;
@@ -3353,7 +4182,7 @@ static void check_pending(const dev_config & cfg, dev_state & state,
 {
   // Find attribute index
   int i = ata_find_attr_index(id, smartval);
-  if (!(i >= 0 && ata_find_attr_index(id, state.smartval) == i))
+  if (!(i >= 0 && ata_find_attr_index(id, state.ata_data->smartval) == i))
     return;
 
   // No report if no sectors pending.
@@ -3362,11 +4191,14 @@ static void check_pending(const dev_config & cfg, dev_state & state,
     reset_warning_mail(cfg, state, mailtype, "No more %s", msg);
     return;
   }
+  add_risk(state, risk_pending);
 
   // If attribute is not reset, report only sector count increases.
-  uint64_t prev_rawval = ata_get_attr_raw_value(state.smartval.vendor_attributes[i], cfg.attribute_defs);
+  uint64_t prev_rawval = ata_get_attr_raw_value(state.ata_data->smartval.vendor_attributes[i], cfg.attribute_defs);
   if (!(!increase_only || prev_rawval < rawval))
     return;
+  if (prev_rawval < rawval)
+    add_risk(state, risk_pending_incr);
 
   // Format message.
   std::string s = strprintf("Device: %s, %" PRId64 " %s", cfg.name.c_str(), rawval, msg);
@@ -3440,17 +4272,20 @@ static void CheckTemperature(const dev_config & cfg, dev_state & state, unsigned
       PrintOut(LOG_INFO, "Device: %s, Temperature changed %+d Celsius to %u Celsius (Min/Max %s%s/%u%s)\n",
         cfg.name.c_str(), (int)currtemp-(int)state.temperature, currtemp, fmt_temp(state.tempmin, buf), minchg, state.tempmax, maxchg);
       state.temperature = currtemp;
+      mark_changed(state);
     }
   }
 
   // Check limits
   if (cfg.tempcrit && currtemp >= cfg.tempcrit) {
+    add_risk(state, risk_temp_crit);
     PrintOut(LOG_CRIT, "Device: %s, Temperature %u Celsius reached critical limit of %u Celsius (Min/Max %s%s/%u%s)\n",
       cfg.name.c_str(), currtemp, cfg.tempcrit, fmt_temp(state.tempmin, buf), minchg, state.tempmax, maxchg);
     MailWarning(cfg, state, 12, "Device: %s, Temperature %d Celsius reached critical limit of %u Celsius (Min/Max %s%s/%u%s)",
       cfg.name.c_str(), currtemp, cfg.tempcrit, fmt_temp(state.tempmin, buf), minchg, state.tempmax, maxchg);
   }
   else if (cfg.tempinfo && currtemp >= cfg.tempinfo) {
+    add_risk(state, risk_temp_info);
     PrintOut(LOG_INFO, "Device: %s, Temperature %u Celsius reached limit of %u Celsius (Min/Max %s%s/%u%s)\n",
       cfg.name.c_str(), currtemp, cfg.tempinfo, fmt_temp(state.tempmin, buf), minchg, state.tempmax, maxchg);
   }
@@ -3461,6 +4296,173 @@ static void CheckTemperature(const dev_config & cfg, dev_state & state, unsigned
   }
 }
 
+#ifdef __linux__
+
+// Return "DIR/hwmonN/temp1_input" if readable, else empty string.
+static std::string find_hwmon_temp_input(const std::string & dir)
+{
+  DIR * dp = opendir(dir.c_str());
+  if (!dp)
+    return "";
+  std::string file;
+  while (const struct dirent * de = readdir(dp)) {
+    if (strncmp(de->d_name, "hwmon", 5))
+      continue;
+    std::string f = dir + '/' + de->d_name + "/temp1_input";
+    if (!access(f.c_str(), R_OK)) {
+      file = f;
+      break;
+    }
+  }
+  closedir(dp);
+  return file;
+}
+
+// Locate the hwmon temperature input of the device below the sysfs root.
+// Supports the 'drivetemp' (SCSI disks) and 'nvme' kernel drivers.
+static std::string get_hwmon_temp_file(const dev_config & cfg)
+{
+  std::string name = get_sysfs_dev_name(cfg);
+  if (name.empty())
+    return "";
+
+  unsigned ctrl = 0; int n1 = -1, n2 = -1;
+  sscanf(name.c_str(), "nvme%u%nn%*u%n", &ctrl, &n1, &n2);
+  if (n1 == (int)name.size() || n2 == (int)name.size()) {
+    // "nvmeN" or "nvmeNnM" -> controller
+    std::string dir = strprintf("%s/class/nvme/nvme%u", sysfs_root.c_str(), ctrl);
+    std::string file = find_hwmon_temp_input(dir);
+    if (file.empty())
+      file = find_hwmon_temp_input(dir + "/device/hwmon");
+    return file;
+  }
+
+  return find_hwmon_temp_input(sysfs_root + "/block/" + name + "/device/hwmon");
+}
+
+// Read hwmon temperature in Celsius, return 0 on error.
+static unsigned char read_hwmon_temp(const std::string & file)
+{
+  FILE * f = fopen(file.c_str(), "r");
+  if (!f)
+    return 0;
+  long millideg = 0;
+  int rc = fscanf(f, "%ld", &millideg);
+  fclose(f);
+  if (rc != 1 || !(0 < millideg && millideg < 255000))
+    return 0;
+  return (unsigned char)((millideg + 500) / 1000);
+}
+
+#else // __linux__
+
+static inline std::string get_hwmon_temp_file(const dev_config & /*cfg*/)
+{
+  return "";
+}
+
+static inline unsigned char read_hwmon_temp(const std::string & /*file*/)
+{
+  return 0;
+}
+
+#endif // __linux__
+
+// Set up Temperature polling via hwmon ('-c hwmon=N')
+static void init_hwmon_temp(dev_config & cfg, dev_state & state)
+{
+  if (!cfg.hwmontime)
+    return;
+  if (!(cfg.tempdiff || cfg.tempinfo || cfg.tempcrit)) {
+    PrintOut(LOG_INFO, "Device: %s, '-c hwmon' ignored without '-W'\n", cfg.name.c_str());
+    cfg.hwmontime = 0;
+    return;
+  }
+  state.hwmon_temp_file = get_hwmon_temp_file(cfg);
+  if (state.hwmon_temp_file.empty()) {
+    PrintOut(LOG_INFO, "Device: %s, no hwmon Temperature sensor found, '-c hwmon' ignored\n",
+             cfg.name.c_str());
+    cfg.hwmontime = 0;
+    return;
+  }
+  PrintOut(LOG_INFO, "Device: %s, Temperature polled every %d seconds from %s\n",
+           cfg.name.c_str(), cfg.hwmontime, state.hwmon_temp_file.c_str());
+}
+
+// Poll hwmon Temperatures which are due.  No commands are sent to the
+// devices.  Return min(sleepuntil, next poll time).
+static time_t poll_hwmon_temps(const dev_config_vector & configs, dev_state_vector & states,
+                               time_t timenow, time_t sleepuntil)
+{
+  for (unsigned i = 0; i < configs.size(); i++) {
+    const dev_config & cfg = configs.at(i);
+    dev_state & state = states.at(i);
+    if (!cfg.hwmontime || state.hwmon_temp_file.empty())
+      continue;
+
+    if (!state.hwmon_wakeuptime)
+      // First poll after next interval
+      state.hwmon_wakeuptime = timenow + cfg.hwmontime;
+    else if (state.hwmon_wakeuptime <= timenow) {
+      state.hwmon_wakeuptime = timenow + cfg.hwmontime;
+      // Keep Temperature of devices skipped due to power mode
+      if (!state.powerskipcnt) {
+        unsigned char temp = read_hwmon_temp(state.hwmon_temp_file);
+        if (!temp) {
+          PrintOut(LOG_INFO, "Device: %s, failed to read %s, '-c hwmon' disabled\n",
+                   cfg.name.c_str(), state.hwmon_temp_file.c_str());
+          state.hwmon_temp_file.clear();
+          continue;
+        }
+        if (debugmode)
+          PrintOut(LOG_INFO, "Device: %s, hwmon Temperature is %d Celsius\n",
+                   cfg.name.c_str(), (int)temp);
+        CheckTemperature(cfg, state, temp, 0);
+      }
+    }
+
+    if (state.hwmon_wakeuptime < sleepuntil)
+      sleepuntil = state.hwmon_wakeuptime;
+  }
+  return sleepuntil;
+}
+
+// Poll I/O statistics of devices with checks skipped due to power mode
+// ('-c powerpoll=N').  If I/O is detected, the disk is likely spun up by
+// other programs, so it is checked at once without forcing a spin-up.
+// Return time of next poll, set 'wakeup' if a device should be checked.
+static time_t poll_io_activity(const dev_config_vector & configs, dev_state_vector & states,
+                               time_t timenow, time_t sleepuntil, bool & wakeup)
+{
+  for (unsigned i = 0; i < configs.size(); i++) {
+    const dev_config & cfg = configs.at(i);
+    dev_state & state = states.at(i);
+    if (!cfg.powerpoll || state.io_stat_file.empty() || !state.powerskipcnt) {
+      state.io_poll_wakeuptime = 0;
+      continue;
+    }
+
+    if (!state.io_poll_wakeuptime)
+      // First poll after next interval
+      state.io_poll_wakeuptime = timenow + cfg.powerpoll;
+    else if (state.io_poll_wakeuptime <= timenow) {
+      state.io_poll_wakeuptime = timenow + cfg.powerpoll;
+      uint64_t count = read_io_count(state.io_stat_file);
+      if (count && state.io_count && count != state.io_count) {
+        if (debugmode || !cfg.powerquiet)
+          PrintOut(LOG_INFO, "Device: %s, I/O activity detected, checking now\n",
+                   cfg.name.c_str());
+        state.io_woken = wakeup = true;
+        return timenow;
+      }
+    }
+
+    if (state.io_poll_wakeuptime < sleepuntil)
+      sleepuntil = state.io_poll_wakeuptime;
+  }
+  return sleepuntil;
+}
+
 // Check normalized and raw attribute values.
 static void check_attribute(const dev_config & cfg, dev_state & state,
                             const ata_smart_attribute & attr,
@@ -3469,9 +4471,13 @@ static void check_attribute(const dev_config & cfg, dev_state & state,
                             const ata_smart_threshold_entry * thresholds)
 {
   // Check attribute and threshold
-  ata_attr_state attrstate = ata_get_attr_state(attr, attridx, thresholds, cfg.attribute_defs);
+  unsigned char threshold = 0;
+  ata_attr_state attrstate = ata_get_attr_state(attr, attridx, thresholds, cfg.attribute_defs,
+                                                &threshold);
   if (attrstate == ATTRSTATE_NON_EXISTING)
     return;
+  if (attrstate == ATTRSTATE_FAILED_NOW)
+    add_risk(state, risk_attr_failed);
 
   // If requested, check for usage attributes that have failed.
   if (   cfg.usagefailed && attrstate == ATTRSTATE_FAILED_NOW
@@ -3492,6 +4498,10 @@ static void check_attribute(const dev_config & cfg, dev_state & state,
   if (cfg.monitor_attr_flags.is_set(attr.id, MONITOR_IGNORE))
     return;
 
+  // Keep adaptive check interval short while close to threshold
+  if (attrstate == ATTRSTATE_OK && threshold && attr.current <= threshold + 10)
+    mark_changed(state);
+
   // Issue warning if they don't have the same ID in all structures.
   if (attr.id != prev.id) {
     PrintOut(LOG_INFO,"Device: %s, same Attribute has different ID numbers: %d = %d\n",
@@ -3517,6 +4527,7 @@ static void check_attribute(const dev_config & cfg, dev_state & state,
   // Return if no change
   if (!(valchanged || rawchanged))
     return;
+  mark_changed(state);
 
   // Format value strings
   std::string currstr, prevstr;
@@ -3551,14 +4562,102 @@ static void check_attribute(const dev_config & cfg, dev_state & state,
       || (rawchanged && cfg.monitor_attr_flags.is_set(attr.id, MONITOR_RAW_AS_CRIT))) {
     PrintOut(LOG_CRIT, "%s\n", msg.c_str());
     MailWarning(cfg, state, 2, "%s", msg.c_str());
+    add_risk(state, risk_attr_crit);
   }
   else {
     PrintOut(LOG_INFO, "%s\n", msg.c_str());
+    if (prefail && valchanged)
+      add_risk(state, risk_attr_changed);
   }
   state.must_write = true;
 }
 
 
+// Set command timeout of device for regular commands or log reads
+// ('-c timeout=N', '-c logtimeout=N').
+static inline void set_cmd_timeout(const dev_config & cfg, smart_device * dev, bool logs = false)
+{
+  dev->set_timeout(logs && cfg.logtimeout ? cfg.logtimeout : cfg.timeout);
+}
+
+// Detect command timeouts during last check.  Retries are delayed by
+// doubling the check interval after each check with timeouts (max one
+// day).  The device is quarantined after N checks with timeouts in a row
+// ('-c quarantine=N') and reported like a failed open (mail type 9).
+static void check_cmd_timeouts(const dev_config & cfg, dev_state & state,
+                               const smart_device * dev, time_t checkstart)
+{
+  if (!cfg.quarantine)
+    return;
+  const char * name = cfg.name.c_str();
+  time_t now = time(nullptr);
+  int limit = (cfg.timeout ? cfg.timeout : SCSI_TIMEOUT_DEFAULT);
+  if (!(dev->get_errno() == ETIMEDOUT || now - checkstart >= limit)) {
+    if (state.quarantined) {
+      PrintOut(LOG_INFO, "Device: %s, check completed without command timeout, "
+               "leaving quarantine\n", name);
+      state.quarantined = false;
+      reset_warning_mail(cfg, state, 9, "check completed without command timeout");
+    }
+    state.timeout_count = 0;
+    state.retry_time = 0;
+    return;
+  }
+
+  state.timeout_count++;
+  int ct = get_checktime(cfg, state);
+  long delay = ct;
+  for (int i = 1; i < state.timeout_count && delay < 3600L*24; i++)
+    delay *= 2;
+  if (delay > 3600L*24)
+    delay = std::max(3600L*24, (long)ct);
+  // Half interval less to catch the check cycle at end of delay
+  state.retry_time = checkstart + delay - ct / 2;
+  PrintOut(LOG_INFO, "Device: %s, command timeout during check (%d s, %d in a row), "
+           "next check in %ld seconds\n", name, (int)(now - checkstart),
+           state.timeout_count, delay);
+
+  if (!state.quarantined && state.timeout_count >= cfg.quarantine) {
+    state.quarantined = true;
+    PrintOut(LOG_CRIT, "Device: %s, %d checks with command timeout, device quarantined\n",
+             name, state.timeout_count);
+    MailWarning(cfg, state, 9, "Device: %s, %d checks with command timeout, device quarantined",
+                name, state.timeout_count);
+  }
+}
+
+// Default for '-c logcheck=N'
+static constexpr int default_logcheck = 12;
+
+// Return true if the SMART self-test and error logs should be read.
+// The logs could only change if the self-test execution status or the
+// power on hours changed since the last read.  Read the logs anyway
+// at least every N checks ('-c logcheck=N').
+static bool ata_logs_may_have_changed(const dev_config & cfg, dev_state & state,
+                                      const ata_smart_values & curval, bool firstpass)
+{
+  uint64_t poh = ~(uint64_t)0;
+  int i = ata_find_attr_index(9, curval);
+  if (i >= 0)
+    poh = ata_get_attr_raw_value(curval.vendor_attributes[i], cfg.attribute_defs);
+
+  int logcheck = (cfg.logcheck ? cfg.logcheck : default_logcheck);
+  if (!(   firstpass || i < 0 || poh != state.logcheck_poh
+        || state.logcheck_skipcnt + 1 >= logcheck
+        || state.selftest_started
+        || curval.self_test_exec_status != state.ata_data->smartval.self_test_exec_status)) {
+    state.logcheck_skipcnt++;
+    if (debugmode)
+      PrintOut(LOG_INFO, "Device: %s, SMART logs unchanged, skipping read (%d/%d)\n",
+               cfg.name.c_str(), state.logcheck_skipcnt, logcheck - 1);
+    return false;
+  }
+
+  state.logcheck_skipcnt = 0;
+  state.logcheck_poh = poh;
+  return true;
+}
+
 static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device * atadev,
                           bool firstpass, bool allow_selftests)
 {
@@ -3570,10 +4669,12 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
   // user may have requested (with the -n Directive) to leave the disk
   // alone if it is in idle or sleeping mode.  In this case check the
   // power mode and exit without check if needed
+  bool power_resumed = false;
   if (cfg.powermode && !state.powermodefail) {
     int dontcheck=0, powermode=ataCheckPowerMode(atadev);
     const char * mode = 0;
-    if (0 <= powermode && powermode < 0xff) {
+    // Skip if I/O since last check shows that the disk is not spun down
+    if (0 <= powermode && powermode < 0xff && !state.io_active) {
       // wait for possible spin up and check again
       int powermode2;
       sleep(5);
@@ -3644,9 +4745,9 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
 
     // if we are going to skip a check, return now
     if (dontcheck){
-      // skip at most powerskipmax checks
-      if (!cfg.powerskipmax || state.powerskipcnt<cfg.powerskipmax) {
-        CloseDevice(atadev, name);
+      // skip at most powerskipmax checks or until powerstale limit
+      if (power_skip_allowed(cfg, state)) {
+        close_or_keep_device(cfg, atadev);
         // report first only except if state has changed, avoid waking up system disk
         if ((!state.powerskipcnt || state.lastpowermodeskipped != powermode) && !cfg.powerquiet) {
           PrintOut(LOG_INFO, "Device: %s, is in %s mode, suspending checks\n", name, mode);
@@ -3655,19 +4756,27 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
         state.powerskipcnt++;
         return 0;
       }
-      else {
+      else if (cfg.powerskipmax && state.powerskipcnt >= cfg.powerskipmax) {
         PrintOut(LOG_INFO, "Device: %s, %s mode ignored due to reached limit of skipped checks (%d check%s skipped)\n",
           name, mode, state.powerskipcnt, (state.powerskipcnt==1?"":"s"));
       }
+      else {
+        PrintOut(LOG_INFO, "Device: %s, %s mode ignored due to reached limit of %d hour%s since last check (%d check%s skipped)\n",
+          name, mode, cfg.powerstale, (cfg.powerstale==1?"":"s"),
+          state.powerskipcnt, (state.powerskipcnt==1?"":"s"));
+      }
       state.powerskipcnt = 0;
       state.tempmin_delay = time(nullptr) + default_checktime - 60; // Delay Min Temperature update
+      power_resumed = true;
     }
     else if (state.powerskipcnt) {
       PrintOut(LOG_INFO, "Device: %s, is back in %s mode, resuming checks (%d check%s skipped)\n",
         name, mode, state.powerskipcnt, (state.powerskipcnt==1?"":"s"));
       state.powerskipcnt = 0;
       state.tempmin_delay = time(nullptr) + default_checktime - 60; // Delay Min Temperature update
+      power_resumed = true;
     }
+    state.power_lastcheck = time(nullptr);
   }
 
   // check smart status
@@ -3681,11 +4790,13 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
     else if (status==1){
       PrintOut(LOG_CRIT, "Device: %s, FAILED SMART self-check. BACK UP DATA NOW!\n", name);
       MailWarning(cfg, state, 1, "Device: %s, FAILED SMART self-check. BACK UP DATA NOW!", name);
+      add_risk(state, risk_health_failed);
       state.must_write = true;
     }
   }
   
   // Check everything that depends upon SMART Data (eg, Attribute values)
+  bool read_logs = true;
   if (   cfg.usagefailed || cfg.prefail || cfg.usage
       || cfg.curr_pending_id || cfg.offl_pending_id
       || cfg.tempdiff || cfg.tempinfo || cfg.tempcrit
@@ -3721,15 +4832,15 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
         for (int i = 0; i < NUMBER_ATA_SMART_ATTRIBUTES; i++) {
           check_attribute(cfg, state,
                           curval.vendor_attributes[i],
-                          state.smartval.vendor_attributes[i],
-                          i, state.smartthres.thres_entries);
+                          state.ata_data->smartval.vendor_attributes[i],
+                          i, state.ata_data->smartthres.thres_entries);
         }
       }
 
       // Log changes of offline data collection status
       if (cfg.offlinests) {
         if (   curval.offline_data_collection_status
-                != state.smartval.offline_data_collection_status
+                != state.ata_data->smartval.offline_data_collection_status
             || state.offline_started // test was started in previous call
             || (firstpass && (debugmode || (curval.offline_data_collection_status & 0x7d))))
           log_offline_data_coll_status(name, curval.offline_data_collection_status);
@@ -3737,26 +4848,34 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
 
       // Log changes of self-test execution status
       if (cfg.selfteststs) {
-        if (   curval.self_test_exec_status != state.smartval.self_test_exec_status
+        if (   curval.self_test_exec_status != state.ata_data->smartval.self_test_exec_status
             || state.selftest_started // test was started in previous call
             || (firstpass && (debugmode || (curval.self_test_exec_status & 0xf0))))
           log_self_test_exec_status(name, curval.self_test_exec_status);
       }
 
+      // Check whether self-test or error logs may have changed,
+      // always read logs when device is active again after skipped checks
+      if (cfg.selftest || cfg.errorlog || cfg.xerrorlog)
+        read_logs = ata_logs_may_have_changed(cfg, state, curval, firstpass || power_resumed);
+
       // Save the new values for the next time around
-      state.smartval = curval;
+      state.ata_data->smartval = curval;
       state.update_persistent_state();
       state.attrlog_dirty = true;
     }
   }
   state.offline_started = state.selftest_started = false;
   
+  if (read_logs && cfg.logtimeout)
+    set_cmd_timeout(cfg, atadev, true);
+
   // check if number of selftest errors has increased (note: may also DECREASE)
-  if (cfg.selftest)
+  if (cfg.selftest && read_logs)
     CheckSelfTestLogs(cfg, state, SelfTestErrorCount(atadev, name, cfg.firmwarebugs));
 
   // check if number of ATA errors has increased
-  if (cfg.errorlog || cfg.xerrorlog) {
+  if ((cfg.errorlog || cfg.xerrorlog) && read_logs) {
 
     int errcnt1 = -1, errcnt2 = -1;
     if (cfg.errorlog)
@@ -3777,6 +4896,7 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
     if (newc>oldc){
       PrintOut(LOG_CRIT, "Device: %s, ATA error count increased from %d to %d\n",
                name, oldc, newc);
+      add_risk(state, risk_errors);
       MailWarning(cfg, state, 4, "Device: %s, ATA error count increased from %d to %d",
                    name, oldc, newc);
       state.must_write = true;
@@ -3786,17 +4906,34 @@ static int ATACheckDevice(const dev_config & cfg, dev_state & state, ata_device
       state.ataerrorcount=newc;
   }
 
+  if (read_logs && cfg.logtimeout)
+    set_cmd_timeout(cfg, atadev);
+
   // if the user has asked, and device is capable (or we're not yet
   // sure) check whether a self test should be done now.
   if (allow_selftests && !cfg.test_regex.empty()) {
+    // Check foreground I/O load ('-c testbusy/testlat=N')
+    update_io_load(cfg, state);
+    check_test_io_load(cfg, state, atadev);
     char testtype = next_scheduled_test(cfg, state, false/*!scsi*/);
+    if (cfg.testbusy || cfg.testlat || state.test_postponed)
+      testtype = postpone_test_if_busy(cfg, state, testtype);
+    // Limit number of running self-tests ('-c testmax[group]=N')
+    if (testtype && (cfg.testmax || cfg.testmaxgroup))
+      testtype = queue_test_if_limited(cfg, state, testtype);
     if (testtype)
       DoATASelfTest(cfg, state, atadev, testtype);
   }
 
+  // Remember if multi-sector READ LOG EXT failed
+  if (atadev->single_sector_log_ext() && !state.ata_log_ext_single) {
+    state.ata_log_ext_single = 1;
+    state.must_write = true;
+  }
+
   // Don't leave device open -- the OS/user may want to access it
-  // before the next smartd cycle!
-  CloseDevice(atadev, name);
+  // before the next smartd cycle! (unless '--keep-open' is specified)
+  close_or_keep_device(cfg, atadev);
   return 0;
 }
 
@@ -3825,6 +4962,7 @@ static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_devic
     if (cp) {
       PrintOut(LOG_CRIT, "Device: %s, SMART Failure: %s\n", name, cp);
       MailWarning(cfg, state, 1,"Device: %s, SMART Failure: %s", name, cp);
+      add_risk(state, risk_health_failed);
     } else if (asc == 4 && ascq == 9) {
       PrintOut(LOG_INFO,"Device: %s, self-test in progress\n", name);
     } else if (debugmode)
@@ -3838,11 +4976,26 @@ static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_devic
     CheckTemperature(cfg, state, currenttemp, triptemp);
 
   // check if number of selftest errors has increased (note: may also DECREASE)
-  if (cfg.selftest)
+  if (cfg.selftest) {
+    set_cmd_timeout(cfg, scsidev, true);
     CheckSelfTestLogs(cfg, state, scsiCountFailedSelfTests(scsidev, 0));
+    set_cmd_timeout(cfg, scsidev);
+  }
 
   if (allow_selftests && !cfg.test_regex.empty()) {
+    // Check foreground I/O load ('-c testbusy=N')
+    update_io_load(cfg, state);
+    // Check whether self-test started by smartd is still running
+    int inprogress = 0;
+    if (state.test_running && !(   !scsiSelfTestInProgress(scsidev, &inprogress)
+                                && inprogress == 1))
+      state.test_running = 0;
     char testtype = next_scheduled_test(cfg, state, true/*scsi*/);
+    if (cfg.testbusy || cfg.testlat || state.test_postponed)
+      testtype = postpone_test_if_busy(cfg, state, testtype);
+    // Limit number of running self-tests ('-c testmax[group]=N')
+    if (testtype && (cfg.testmax || cfg.testmaxgroup))
+      testtype = queue_test_if_limited(cfg, state, testtype);
     if (testtype)
       DoSCSISelfTest(cfg, state, scsidev, testtype);
   }
@@ -3851,33 +5004,33 @@ static int SCSICheckDevice(const dev_config & cfg, dev_state & state, scsi_devic
     uint8_t tBuf[252];
     if (state.ReadECounterPageSupported && (0 == scsiLogSense(scsidev,
       READ_ERROR_COUNTER_LPAGE, 0, tBuf, sizeof(tBuf), 0))) {
-      scsiDecodeErrCounterPage(tBuf, &state.scsi_error_counters[0].errCounter,
+      scsiDecodeErrCounterPage(tBuf, &state.scsi_errors->counters[0].errCounter,
                                scsiLogRespLen);
-      state.scsi_error_counters[0].found=1;
+      state.scsi_errors->counters[0].found=1;
     }
     if (state.WriteECounterPageSupported && (0 == scsiLogSense(scsidev,
       WRITE_ERROR_COUNTER_LPAGE, 0, tBuf, sizeof(tBuf), 0))) {
-      scsiDecodeErrCounterPage(tBuf, &state.scsi_error_counters[1].errCounter,
+      scsiDecodeErrCounterPage(tBuf, &state.scsi_errors->counters[1].errCounter,
                                scsiLogRespLen);
-      state.scsi_error_counters[1].found=1;
+      state.scsi_errors->counters[1].found=1;
     }
     if (state.VerifyECounterPageSupported && (0 == scsiLogSense(scsidev,
       VERIFY_ERROR_COUNTER_LPAGE, 0, tBuf, sizeof(tBuf), 0))) {
-      scsiDecodeErrCounterPage(tBuf, &state.scsi_error_counters[2].errCounter,
+      scsiDecodeErrCounterPage(tBuf, &state.scsi_errors->counters[2].errCounter,
                                scsiLogRespLen);
-      state.scsi_error_counters[2].found=1;
+      state.scsi_errors->counters[2].found=1;
     }
     if (state.NonMediumErrorPageSupported && (0 == scsiLogSense(scsidev,
       NON_MEDIUM_ERROR_LPAGE, 0, tBuf, sizeof(tBuf), 0))) {
-      scsiDecodeNonMediumErrPage(tBuf, &state.scsi_nonmedium_error.nme,
+      scsiDecodeNonMediumErrPage(tBuf, &state.scsi_errors->nonmedium.nme,
                                  scsiLogRespLen);
-      state.scsi_nonmedium_error.found=1;
+      state.scsi_errors->nonmedium.found=1;
     }
     // store temperature if not done by CheckTemperature() above
     if (!(cfg.tempdiff || cfg.tempinfo || cfg.tempcrit))
       state.temperature = currenttemp;
   }
-  CloseDevice(scsidev, name);
+  close_or_keep_device(cfg, scsidev);
   state.attrlog_dirty = true;
   return 0;
 }
@@ -3892,7 +5045,7 @@ static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_devic
   // Read SMART/Health log
   nvme_smart_log smart_log;
   if (!nvme_read_smart_log(nvmedev, smart_log)) {
-      CloseDevice(nvmedev, name);
+      close_or_keep_device(cfg, nvmedev);
       PrintOut(LOG_INFO, "Device: %s, failed to read NVMe SMART/Health Information\n", name);
       MailWarning(cfg, state, 6, "Device: %s, failed to read NVMe SMART/Health Information", name);
       state.must_write = true;
@@ -3922,6 +5075,7 @@ static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_devic
 
     PrintOut(LOG_CRIT, "Device: %s, Critical Warning (0x%02x): %s\n", name, w, msg.c_str());
     MailWarning(cfg, state, 1, "Device: %s, Critical Warning (0x%02x): %s", name, w, msg.c_str());
+    add_risk(state, risk_health_failed);
     state.must_write = true;
   }
 
@@ -3942,12 +5096,14 @@ static int NVMeCheckDevice(const dev_config & cfg, dev_state & state, nvme_devic
     uint64_t newcnt = le128_to_uint64(smart_log.num_err_log_entries);
     if (newcnt > state.nvme_err_log_entries) {
       // Warn only if device related errors are found
+      set_cmd_timeout(cfg, nvmedev, true);
       check_nvme_error_log(cfg, state, nvmedev, newcnt);
+      set_cmd_timeout(cfg, nvmedev);
     }
     // else // TODO: Handle decrease of count?
   }
 
-  CloseDevice(nvmedev, name);
+  close_or_keep_device(cfg, nvmedev);
   state.attrlog_dirty = true;
   return 0;
 }
@@ -3995,10 +5151,10 @@ static void do_disable_standby_check(const dev_config_vector & configs, const de
 
     if (   (   cfg.offlinests_ns
             && (state.offline_started ||
-                is_offl_coll_in_progress(state.smartval.offline_data_collection_status)))
+                is_offl_coll_in_progress(state.ata_data->smartval.offline_data_collection_status)))
         || (   cfg.selfteststs_ns
             && (state.selftest_started ||
-                is_self_test_in_progress(state.smartval.self_test_exec_status)))         )
+                is_self_test_in_progress(state.ata_data->smartval.self_test_exec_status)))         )
       running = true;
     // state.offline/selftest_started will be reset after next logging of test status
   }
@@ -4033,28 +5189,93 @@ static void do_disable_standby_check(const dev_config_vector & configs, const de
 static void CheckDevicesOnce(const dev_config_vector & configs, dev_state_vector & states,
                              smart_device_list & devices, bool firstpass, bool allow_selftests)
 {
+  // Check devices with highest risk score first, devices deferred in
+  // last cycle next, then all others in configuration order.
+  time_t now = time(nullptr);
+  std::vector<unsigned> order;
+  order.reserve(configs.size());
   for (unsigned i = 0; i < configs.size(); i++) {
+    if (states[i].skip) {
+      if (firstpass)
+        states[i].first_check = true;
+      if (debugmode)
+        PrintOut(LOG_INFO, "Device: %s, skipped (interval=%d)\n", configs[i].name.c_str(),
+                 get_checktime(configs[i], states[i]));
+      continue;
+    }
+    if (states[i].retry_time && now < states[i].retry_time && !firstpass) {
+      if (debugmode)
+        PrintOut(LOG_INFO, "Device: %s, skipped (%s, retry in %d seconds)\n",
+                 configs[i].name.c_str(), (states[i].quarantined ? "quarantined" : "timeout"),
+                 (int)(states[i].retry_time - now));
+      continue;
+    }
+    order.push_back(i);
+  }
+  // Quarantined devices are checked last
+  std::stable_sort(order.begin(), order.end(),
+    [&states](unsigned a, unsigned b) {
+      if (states[a].quarantined != states[b].quarantined)
+        return !states[a].quarantined;
+      if (states[a].risk != states[b].risk)
+        return (states[a].risk > states[b].risk);
+      return (states[a].deferred && !states[b].deferred);
+    }
+  );
+
+  if (allow_selftests)
+    init_test_slots(configs, states);
+
+  time_t starttime = time(nullptr);
+  unsigned checked = 0, deferred = 0;
+  for (unsigned i : order) {
     const dev_config & cfg = configs.at(i);
     dev_state & state = states.at(i);
-    if (state.skip) {
+
+    // Defer low risk devices if cycle time budget is exceeded ('--cycle-budget=N').
+    // A device is not deferred in two cycles in a row.
+    if (   cycle_budget && !firstpass && !state.deferred && state.risk < risk_low_limit
+        && time(nullptr) - starttime >= cycle_budget) {
       if (debugmode)
-        PrintOut(LOG_INFO, "Device: %s, skipped (interval=%d)\n", cfg.name.c_str(),
-                 (cfg.checktime ? cfg.checktime : checktime));
+        PrintOut(LOG_INFO, "Device: %s, check deferred to next cycle (risk=%d)\n",
+                 cfg.name.c_str(), state.risk);
+      state.deferred = true;
+      deferred++;
       continue;
     }
+    state.deferred = false;
+    if (debugmode && state.risk)
+      PrintOut(LOG_INFO, "Device: %s, risk score %d\n", cfg.name.c_str(), state.risk);
+    state.risk /= 2;
+    checked++;
+
+    // First check of a device delayed by '--stagger' is handled like
+    // a check in the first pass: no self-tests, log current status
+    bool first = (firstpass || state.first_check);
+    bool selftests = (allow_selftests && !state.first_check);
+    state.first_check = false;
 
     smart_device * dev = devices.at(i);
+    time_t checkstart = time(nullptr);
+    dev->clear_err();
     if (dev->is_ata())
-      ATACheckDevice(cfg, state, dev->to_ata(), firstpass, allow_selftests);
+      ATACheckDevice(cfg, state, dev->to_ata(), first, selftests);
     else if (dev->is_scsi())
-      SCSICheckDevice(cfg, state, dev->to_scsi(), allow_selftests);
+      SCSICheckDevice(cfg, state, dev->to_scsi(), selftests);
     else if (dev->is_nvme())
       NVMeCheckDevice(cfg, state, dev->to_nvme());
+    check_cmd_timeouts(cfg, state, dev, checkstart);
+    update_checktime(cfg, state);
 
     // Prevent systemd unit startup timeout when checking many devices on startup
     notify_extend_timeout();
   }
 
+  if (deferred)
+    PrintOut(LOG_INFO, "Check cycle exceeded time budget of %d seconds after %u devices, "
+             "%u low risk device%s deferred\n", cycle_budget, checked, deferred,
+             (deferred == 1 ? "" : "s"));
+
   do_disable_standby_check(configs, states);
 }
 
@@ -4109,6 +5330,19 @@ time_t calc_next_wakeuptime(time_t wakeuptime, time_t timenow, int ct)
   return timenow + ct - (timenow - wakeuptime) % ct;
 }
 
+// Return next check time of a device with phase offset ('--stagger=MODE').
+// Check times are multiples of the interval plus the phase offset, so
+// the checks of all devices are spread evenly over the interval.
+static time_t calc_phase_wakeuptime(time_t wakeuptime, time_t timenow, int ct, uint32_t phase)
+{
+  if (timenow < wakeuptime)
+    return wakeuptime;
+  time_t offset = (time_t)(((uint64_t)phase * ct) >> 32);
+  // Keep at least half an interval after a check out of phase (SIGUSR1)
+  time_t after = (wakeuptime ? timenow + ct / 2 : timenow);
+  return ((after - offset) / ct + 1) * ct + offset;
+}
+
 static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
   dev_state_vector & states, bool & sigwakeup)
 {
@@ -4127,9 +5361,14 @@ static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
     for (unsigned i = 0; i < n; i++) {
       const dev_config & cfg = configs.at(i);
       dev_state & state = states.at(i);
-      if (!state.skip)
+      if (state.skip)
+        ;
+      else if (stagger_mode)
+        state.wakeuptime = calc_phase_wakeuptime(state.wakeuptime, timenow,
+          get_checktime(cfg, state), state.phase);
+      else
         state.wakeuptime = calc_next_wakeuptime((state.wakeuptime ? state.wakeuptime : timenow),
-          timenow, (cfg.checktime ? cfg.checktime : checktime));
+          timenow, get_checktime(cfg, state));
       if (!wakeuptime || state.wakeuptime < wakeuptime)
         wakeuptime = state.wakeuptime;
     }
@@ -4139,9 +5378,12 @@ static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
   notify_wait(wakeuptime, n);
 
   // Sleep until we catch a signal or have completed sleeping
-  bool no_skip = false;
+  bool no_skip = false, io_wakeup = false;
   int addtime = 0;
-  while (timenow < wakeuptime+addtime && !caughtsigUSR1 && !caughtsigHUP && !caughtsigEXIT) {
+  for (auto & state : states)
+    state.io_woken = false;
+  while (   timenow < wakeuptime+addtime && !io_wakeup
+         && !caughtsigUSR1 && !caughtsigHUP && !caughtsigEXIT) {
     // Restart if system clock has been adjusted to the past
     if (wakeuptime > timenow + ct) {
       PrintOut(LOG_INFO, "System clock time adjusted to the past. Resetting next wakeup time.\n");
@@ -4151,8 +5393,14 @@ static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
       no_skip = true;
     }
     
+    // Poll hwmon Temperatures ('-c hwmon=N') until next wakeup time
+    time_t sleepuntil = poll_hwmon_temps(configs, states, timenow, wakeuptime+addtime);
+    // Poll I/O of devices in low-power mode ('-c powerpoll=N')
+    sleepuntil = poll_io_activity(configs, states, timenow, sleepuntil, io_wakeup);
+
     // Exit sleep when time interval has expired or a signal is received
-    sleep(wakeuptime+addtime-timenow);
+    if (sleepuntil > timenow)
+      sleep(sleepuntil-timenow);
 
 #ifdef _WIN32
     // toggle debug mode?
@@ -4186,10 +5434,27 @@ static time_t dosleep(time_t wakeuptime, const dev_config_vector & configs,
     sigwakeup = no_skip = true;
   }
 
-  // Check which devices must be skipped in this cycle
-  if (checktime_min) {
+  // All devices are checked now, next regular check of each device
+  // ('--stagger') follows at least half an interval later
+  if (no_skip && stagger_mode) {
+    for (unsigned i = 0; i < n; i++) {
+      dev_state & state = states.at(i);
+      state.wakeuptime = calc_phase_wakeuptime(timenow, timenow,
+        get_checktime(configs.at(i), state), state.phase);
+    }
+  }
+
+  // Check which devices must be skipped in this cycle,
+  // deferred devices are checked at next wakeup.
+  // After wakeup due to I/O, only devices with I/O are checked.
+  if (checktime_min || io_wakeup) {
     for (auto & state : states)
-      state.skip = (!no_skip && timenow < state.wakeuptime);
+      state.skip = (   !no_skip && !state.deferred && !state.io_woken
+                    && timenow < (checktime_min ? state.wakeuptime : wakeuptime));
+  }
+  else {
+    for (auto & state : states)
+      state.skip = false;
   }
   
   // return adjusted wakeuptime
@@ -4201,7 +5466,7 @@ static void printoutvaliddirectiveargs(int priority, char d)
 {
   switch (d) {
   case 'n':
-    PrintOut(priority, "never[,N][,q], sleep[,N][,q], standby[,N][,q], idle[,N][,q]");
+    PrintOut(priority, "never[,N][,q][,io], sleep[,N][,q][,io], standby[,N][,q][,io], idle[,N][,q][,io]");
     break;
   case 's':
     PrintOut(priority, "valid_regular_expression");
@@ -4236,7 +5501,10 @@ static void printoutvaliddirectiveargs(int priority, char d)
                        "security-freeze, standby,[N|off], wcache,[on|off]");
     break;
   case 'c':
-    PrintOut(priority, "i=N, interval=N");
+    PrintOut(priority, "i=N[-M], interval=N[-M], logcheck=N, hwmon=N, powerpoll=N, powerstale=N, "
+                       "testbusy=N, testlat=N, "
+                       "scrub=N, scrubtime=N, testmax=N, testmaxgroup=N, "
+                       "timeout=N, logtimeout=N, quarantine=N");
     break;
   }
 }
@@ -4508,6 +5776,7 @@ static int ParseToken(char * token, dev_config & cfg, smart_devtype_list & scan_
       char *next = strchr(const_cast<char*>(arg), ',');
 
       cfg.powerquiet = false;
+      cfg.powerio = false;
       cfg.powerskipmax = 0;
 
       if (next)
@@ -4534,12 +5803,15 @@ static int ParseToken(char * token, dev_config & cfg, smart_devtype_list & scan_
           if (cfg.powerskipmax <= 0)
             badarg = 1;
         }
-        if (*next != '\0') {
-          if (!strcmp("q", next))
+        while (!badarg && *next != '\0') {
+          int len = strcspn(next, ",");
+          if (len == 1 && *next == 'q')
             cfg.powerquiet = true;
-          else {
+          else if (len == 2 && !strncmp(next, "io", 2))
+            cfg.powerio = true;
+          else
             badarg = 1;
-          }
+          next += len + (next[len] == ',');
         }
       }
     }
@@ -4783,11 +6055,56 @@ static int ParseToken(char * token, dev_config & cfg, smart_devtype_list & scan_
         missingarg = true;
         break;
       }
-      int n = 0, nc = -1, len = strlen(arg);
+      int n = 0, m = 0, nc = -1, len = strlen(arg);
       if (   (   sscanf(arg, "i=%d%n", &n, &nc) == 1
               || sscanf(arg, "interval=%d%n", &n, &nc) == 1)
-          && nc == len && n >= 10)
-        cfg.checktime = n;
+          && nc == len && n >= 10) {
+        cfg.checktime = n; cfg.checktime_max = 0;
+      }
+      else if (   (   sscanf(arg, "i=%d-%d%n", &n, &m, &nc) == 2
+                   || sscanf(arg, "interval=%d-%d%n", &n, &m, &nc) == 2)
+               && nc == len && n >= 10 && m >= n) {
+        cfg.checktime = n; cfg.checktime_max = (m > n ? m : 0);
+      }
+      else if (   sscanf(arg, "logcheck=%d%n", &n, &nc) == 1
+               && nc == len && n >= 1)
+        cfg.logcheck = n;
+      else if (   sscanf(arg, "hwmon=%d%n", &n, &nc) == 1
+               && nc == len && n >= 10)
+        cfg.hwmontime = n;
+      else if (   sscanf(arg, "powerpoll=%d%n", &n, &nc) == 1
+               && nc == len && n >= 10)
+        cfg.powerpoll = n;
+      else if (   sscanf(arg, "powerstale=%d%n", &n, &nc) == 1
+               && nc == len && 1 <= n && n <= 24*365)
+        cfg.powerstale = n;
+      else if (   sscanf(arg, "testbusy=%d%n", &n, &nc) == 1
+               && nc == len && n >= 1)
+        cfg.testbusy = n;
+      else if (   sscanf(arg, "testlat=%d%n", &n, &nc) == 1
+               && nc == len && n >= 1)
+        cfg.testlat = n;
+      else if (   sscanf(arg, "scrub=%d%n", &n, &nc) == 1
+               && nc == len && 1 <= n && n <= 3650)
+        cfg.scrubdays = n;
+      else if (   sscanf(arg, "scrubtime=%d%n", &n, &nc) == 1
+               && nc == len && 1 <= n && n <= 24*60)
+        cfg.scrubtime = n;
+      else if (   sscanf(arg, "testmax=%d%n", &n, &nc) == 1
+               && nc == len && n >= 1)
+        cfg.testmax = n;
+      else if (   sscanf(arg, "testmaxgroup=%d%n", &n, &nc) == 1
+               && nc == len && n >= 1)
+        cfg.testmaxgroup = n;
+      else if (   sscanf(arg, "timeout=%d%n", &n, &nc) == 1
+               && nc == len && 1 <= n && n <= 3600)
+        cfg.timeout = n;
+      else if (   sscanf(arg, "logtimeout=%d%n", &n, &nc) == 1
+               && nc == len && 1 <= n && n <= 3600)
+        cfg.logtimeout = n;
+      else if (   sscanf(arg, "quarantine=%d%n", &n, &nc) == 1
+               && nc == len && 0 <= n && n <= 100)
+        cfg.quarantine = n;
       else
         badarg = true;
     }
@@ -5071,13 +6388,13 @@ static int ParseConfigFile(dev_config_vector & conf_entries, smart_devtype_list
 
 /* Prints the message "=======> VALID ARGUMENTS ARE: <LIST>  <=======\n", where
    <LIST> is the list of valid arguments for option opt. */
-static void PrintValidArgs(char opt)
+static void PrintValidArgs(int opt)
 {
   const char *s;
 
   PrintOut(LOG_CRIT, "=======> VALID ARGUMENTS ARE: ");
   if (!(s = GetValidArgList(opt)))
-    PrintOut(LOG_CRIT, "Error constructing argument list for option %c", opt);
+    PrintOut(LOG_CRIT, "Error constructing argument list for option %c", (char)opt);
   else
     PrintOut(LOG_CRIT, "%s", (char *)s);
   PrintOut(LOG_CRIT, " <=======\n");
@@ -5151,6 +6468,12 @@ static int parse_options(int argc, char **argv)
 #endif
 #ifdef HAVE_LIBCAP_NG
     { "capabilities",   optional_argument, 0, 'C' },
+#endif
+    { "keep-open",      no_argument,       0, opt_keep_open },
+    { "cycle-budget",   required_argument, 0, opt_cycle_budget },
+    { "stagger",        required_argument, 0, opt_stagger },
+#ifdef __linux__
+    { "sysfs-root",     required_argument, 0, opt_sysfs_root },
 #endif
     { 0,                0,                 0, 0   }
   };
@@ -5199,6 +6522,17 @@ static int parse_options(int argc, char **argv)
         quit = QUIT_SHOWTESTS;
         debugmode = 1;
       }
+      else if (str_starts_with(optarg, "benchmark,")) {
+        int n = -1, len = -1;
+        sscanf(optarg, "benchmark,%d%n", &n, &len);
+        if (!(len == (int)strlen(optarg) && n > 0))
+          badarg = true;
+        else {
+          quit = QUIT_BENCHMARK;
+          quit_benchmark_cycles = n;
+          debugmode = 1;
+        }
+      }
       else
         badarg = true;
       break;
@@ -5348,6 +6682,37 @@ static int parse_options(int argc, char **argv)
       else
         badarg = true;
       break;
+#endif
+    case opt_keep_open:
+      // keep devices open between checks
+      keep_open = true;
+      break;
+    case opt_stagger:
+      // spread checks over the interval
+      if (!strcmp(optarg, "position"))
+        stagger_mode = STAGGER_POSITION;
+      else if (!strcmp(optarg, "serial"))
+        stagger_mode = STAGGER_SERIAL;
+      else
+        badarg = true;
+      break;
+    case opt_cycle_budget:
+      // time budget of a check cycle
+      {
+        char * end = nullptr;
+        errno = 0;
+        long n = strtol(optarg, &end, 10);
+        if (!(!errno && end != optarg && !*end && 0 <= n && n <= INT_MAX))
+          badarg = true;
+        else
+          cycle_budget = (int)n;
+      }
+      break;
+#ifdef __linux__
+    case opt_sysfs_root:
+      // use other sysfs root (for testing)
+      sysfs_root = optarg;
+      break;
 #endif
     case 'h':
       // help: print summary of command-line options
@@ -5366,7 +6731,7 @@ static int parse_options(int argc, char **argv)
       // Check whether the option is a long option that doesn't map to -h.
       if (arg[1] == '-' && optchar != 'h') {
         // Iff optopt holds a valid option then argument must be missing.
-        if (optopt && strchr(shortopts, optopt)) {
+        if (optopt && (optopt > '~' ? !!GetValidArgList(optopt) : !!strchr(shortopts, optopt))) {
           PrintOut(LOG_CRIT, "=======> ARGUMENT REQUIRED FOR OPTION: %s <=======\n",arg+2);
           PrintValidArgs(optopt);
         } else {
@@ -5375,7 +6740,7 @@ static int parse_options(int argc, char **argv)
         PrintOut(LOG_CRIT, "\nUse smartd --help to get a usage summary\n\n");
         return EXIT_BADCMD;
       }
-      if (optopt) {
+      if (0 < optopt && optopt < '~') {
         // Iff optopt holds a valid option then argument must be missing.
         if (strchr(shortopts, optopt)){
           PrintOut(LOG_CRIT, "=======> ARGUMENT REQUIRED FOR OPTION: %c <=======\n",optopt);
@@ -5396,8 +6761,17 @@ static int parse_options(int argc, char **argv)
       PrintHead();
       // It would be nice to print the actual option name given by the user
       // here, but we just print the short form.  Please fix this if you know
-      // a clean way to do it.
-      PrintOut(LOG_CRIT, "=======> INVALID ARGUMENT TO -%c: %s <======= \n", optchar, optarg);
+      // a clean way to do it.  Long only options are printed as such.
+      char optstr[] = { (char)optchar, 0 };
+      const char * optname = optstr;
+      for (int i = 0; optchar > '~' && longopts[i].name; i++) {
+        if (longopts[i].val == optchar) {
+          optname = longopts[i].name;
+          break;
+        }
+      }
+      PrintOut(LOG_CRIT, "=======> INVALID ARGUMENT TO -%s%s: %s <======= \n",
+               (optname != optstr ? "-" : ""), optname, optarg);
       if (badarg_msg)
         PrintOut(LOG_CRIT, "%s\n", badarg_msg);
       else
@@ -5558,7 +6932,7 @@ static int ReadOrMakeConfigEntries(dev_config_vector & conf_entries, smart_devic
 
 // Register one device, return false on error
 static bool register_device(dev_config & cfg, dev_state & state, smart_device_auto_ptr & dev,
-                            const dev_config_vector * prev_cfgs)
+                            const dev_name_index * prev_ids)
 {
   bool scanning;
   if (!dev) {
@@ -5600,22 +6974,25 @@ static bool register_device(dev_config & cfg, dev_state & state, smart_device_au
   cfg.name = dev->get_info().info_name;
   PrintOut(LOG_INFO, "Device: %s, opened\n", cfg.name.c_str());
 
+  // Apply '-c timeout=N' also to commands during registration
+  set_cmd_timeout(cfg, dev.get());
+
   int status;
   const char * typemsg;
   // register ATA device
   if (dev->is_ata()){
     typemsg = "ATA";
-    status = ATADeviceScan(cfg, state, dev->to_ata(), prev_cfgs);
+    status = ATADeviceScan(cfg, state, dev->to_ata(), prev_ids);
   }
   // or register SCSI device
   else if (dev->is_scsi()){
     typemsg = "SCSI";
-    status = SCSIDeviceScan(cfg, state, dev->to_scsi(), prev_cfgs);
+    status = SCSIDeviceScan(cfg, state, dev->to_scsi(), prev_ids);
   }
   // or register NVMe device
   else if (dev->is_nvme()) {
     typemsg = "NVMe";
-    status = NVMeDeviceScan(cfg, state, dev->to_nvme(), prev_cfgs);
+    status = NVMeDeviceScan(cfg, state, dev->to_nvme(), prev_ids);
   }
   else {
     PrintOut(LOG_INFO, "Device: %s, neither ATA, SCSI nor NVMe device\n", cfg.name.c_str());
@@ -5639,6 +7016,94 @@ static bool register_device(dev_config & cfg, dev_state & state, smart_device_au
   return true;
 }
 
+// Get identities of a device which are available without opening it:
+// "dev_t:N" of the device node and, on Linux, "wwid:ID" from sysfs.
+// Paths of a multipath device share the WWID.  Ports behind RAID
+// controllers share the device node and are not identified.
+static void get_dev_path_ids(const dev_config & cfg, std::vector<std::string> & ids)
+{
+  ids.clear();
+  const std::string & type = cfg.dev_type;
+  if (!(   type.empty() || type == "ata" || type == "scsi" || type == "nvme"
+        || type == "sat" || str_starts_with(type, "sat,") || type == "auto"))
+    return;
+
+#ifndef _WIN32
+  struct stat st;
+  if (!stat(cfg.dev_name.c_str(), &st) && (S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode)))
+    ids.push_back(strprintf("dev_t:%lx", (unsigned long)st.st_rdev));
+#endif
+
+#ifdef __linux__
+  std::string name = get_sysfs_dev_name(cfg);
+  if (name.empty())
+    return;
+  // SCSI disks: ".../device/wwid", NVMe namespaces: ".../wwid"
+  for (const char * file : {"/device/wwid", "/wwid"}) {
+    FILE * f = fopen((sysfs_root + "/block/" + name + file).c_str(), "r");
+    if (!f)
+      continue;
+    char buf[256] = "";
+    if (!fgets(buf, sizeof(buf), f))
+      buf[0] = 0;
+    fclose(f);
+    int len = strcspn(buf, "\n");
+    while (len > 0 && buf[len-1] == ' ')
+      len--;
+    if (len > 0)
+      ids.push_back(std::string("wwid:") + std::string(buf, len));
+    break;
+  }
+#endif
+}
+
+// Add identities to index, keep first device.
+static void add_dev_path_ids(dev_name_index & index, const std::vector<std::string> & ids,
+                             const std::string & name)
+{
+  for (const auto & id : ids)
+    index.emplace(id, name);
+}
+
+// Return hash of serial number of device, or of device name if unknown.
+static uint32_t get_serial_hash(const dev_config & cfg)
+{
+  std::string s = cfg.dev_idinfo;
+  std::string::size_type i = s.find("S/N:");
+  if (i != std::string::npos)
+    s = s.substr(i, s.find(',', i) - i);
+  else if (s.empty())
+    s = cfg.name;
+  uint32_t h = 2166136261U; // FNV-1a
+  for (char c : s)
+    h = (h ^ (unsigned char)c) * 16777619U;
+  return h;
+}
+
+// Set phase offsets of checks from position in device list or serial
+// number hash.  Unless all devices should be checked once, the first
+// check of each device is done at its phase offset instead of all in
+// the first check cycle.
+static void set_check_phases(const dev_config_vector & configs, dev_state_vector & states)
+{
+  time_t now = time(nullptr);
+  unsigned n = configs.size();
+  for (unsigned i = 0; i < n; i++) {
+    const dev_config & cfg = configs[i];
+    dev_state & state = states[i];
+    state.phase = (stagger_mode == STAGGER_POSITION ? (uint32_t)(((uint64_t)i << 32) / n)
+                                                    : get_serial_hash(cfg));
+    int ct = get_checktime(cfg, state);
+    if (debugmode)
+      PrintOut(LOG_INFO, "Device: %s, checks staggered by %d of %d seconds\n", cfg.name.c_str(),
+               (int)(((uint64_t)state.phase * ct) >> 32), ct);
+    if (quit == QUIT_ONECHECK || quit == QUIT_BENCHMARK)
+      continue;
+    state.wakeuptime = calc_phase_wakeuptime(0, now, ct, state.phase);
+    state.skip = true;
+  }
+}
+
 // This function tries devices from conf_entries.  Each one that can be
 // registered is moved onto the [ata|scsi]devices lists and removed
 // from the conf_entries list.
@@ -5651,8 +7116,12 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
   states.clear();
 
   // Map of already seen non-DEVICESCAN devices (unique_name -> cfg.name)
-  typedef std::map<std::string, std::string> prev_unique_names_map;
-  prev_unique_names_map prev_unique_names;
+  dev_name_index prev_unique_names;
+  // Map of dev_t and WWID of all seen devices (id -> cfg.name)
+  dev_name_index prev_path_ids;
+  // Map of identify info of all registered devices (dev_idinfo -> cfg.dev_name)
+  dev_name_index prev_ids;
+  std::vector<std::string> path_ids;
 
   // Register entries
   for (unsigned i = 0; i < conf_entries.size(); i++) {
@@ -5665,6 +7134,7 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
            (!cfg.dev_type.empty() ? " [" : ""), cfg.dev_type.c_str(),
            (!cfg.dev_type.empty() ? "]" : ""), unique_name.c_str());
     }
+    get_dev_path_ids(cfg, path_ids);
 
     if (cfg.ignore) {
       // Store for duplicate detection and ignore
@@ -5672,6 +7142,7 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
                (!cfg.dev_type.empty() ? " [" : ""), cfg.dev_type.c_str(),
                (!cfg.dev_type.empty() ? "]" : ""));
       prev_unique_names[unique_name] = cfg.name;
+      add_dev_path_ids(prev_path_ids, path_ids, cfg.name);
       continue;
     }
 
@@ -5683,13 +7154,32 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
       dev = scanned_devs.release(i);
       if (dev) {
         // Check for a preceding non-DEVICESCAN entry for the same device
-        prev_unique_names_map::iterator ui = prev_unique_names.find(unique_name);
+        auto ui = prev_unique_names.find(unique_name);
         if (ui != prev_unique_names.end()) {
           bool ne = (ui->second != cfg.name);
           PrintOut(LOG_INFO, "Device: %s, %s%s, ignored\n", dev->get_info_name(),
                    (ne ? "same as " : "duplicate"), (ne ? ui->second.c_str() : ""));
           continue;
         }
+        // Check for same device node or another path of a multipath
+        // device before the device is opened
+        const std::string * same = nullptr; const char * id = nullptr;
+        for (const auto & pid : path_ids) {
+          auto pi = prev_path_ids.find(pid);
+          if (pi != prev_path_ids.end()) {
+            same = &pi->second; id = pid.c_str();
+            break;
+          }
+        }
+        if (same) {
+          if (str_starts_with(id, "wwid:"))
+            PrintOut(LOG_INFO, "Device: %s, other path of %s (WWID %s), using %s, ignored\n",
+                     dev->get_info_name(), same->c_str(), id + 5, same->c_str());
+          else
+            PrintOut(LOG_INFO, "Device: %s, same device node as %s, ignored\n",
+                     dev->get_info_name(), same->c_str());
+          continue;
+        }
         scanning = true;
       }
     }
@@ -5700,7 +7190,7 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
     // Register device
     // If scanning, pass dev_idinfo of previous devices for duplicate check
     dev_state state;
-    if (!register_device(cfg, state, dev, (scanning ? &configs : 0))) {
+    if (!register_device(cfg, state, dev, (scanning ? &prev_ids : 0))) {
       // if device is explicitly listed and we can't register it, then
       // exit unless the user has specified that the device is removable
       if (!scanning) {
@@ -5712,10 +7202,18 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
         PrintOut(LOG_INFO, "Device: %s, not available\n", cfg.name.c_str());
         // Prevent retry of registration
         prev_unique_names[unique_name] = cfg.name;
+        add_dev_path_ids(prev_path_ids, path_ids, cfg.name);
       }
       continue;
     }
 
+    // Find hwmon Temperature sensor if '-c hwmon=N' is specified
+    init_hwmon_temp(cfg, state);
+    // Find I/O statistics if '-n ...,io' or '-c powerpoll=N' is specified
+    init_io_stat(cfg, state);
+    // Find topology group if '-c testmaxgroup=N' is specified
+    init_test_group(cfg, state);
+
     // move onto the list of devices
     configs.push_back(cfg);
     states.push_back(state);
@@ -5723,6 +7221,9 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
     if (!scanning)
       // Store for duplicate detection
       prev_unique_names[unique_name] = cfg.name;
+    add_dev_path_ids(prev_path_ids, path_ids, cfg.name);
+    if (cfg.id_is_unique)
+      prev_ids.emplace(cfg.dev_idinfo, cfg.dev_name);
   }
 
   // Set minimum check time and factors for staggered tests
@@ -5737,11 +7238,75 @@ static bool register_devices(const dev_config_vector & conf_entries, smart_devic
   if (checktime_min && checktime_min > checktime)
     checktime_min = checktime;
 
+  // Set phase offsets for staggered checks ('--stagger=MODE')
+  if (stagger_mode) {
+    set_check_phases(configs, states);
+    if (!checktime_min)
+      checktime_min = checktime;
+  }
+
   init_disable_standby_check(configs);
   return true;
 }
 
 
+// Return peak resident set size in KiB, -1 if unknown
+static long get_max_rss_kib()
+{
+#ifndef _WIN32
+  struct rusage ru;
+  if (!getrusage(RUSAGE_SELF, &ru))
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024; // bytes
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+  return -1;
+}
+
+// Statistics for '-q benchmark,N'
+struct benchmark_stats
+{
+  int cycles;
+  long long min_usec, max_usec, sum_usec;
+  uint64_t commands;
+
+  benchmark_stats()
+    : cycles(0), min_usec(0), max_usec(0), sum_usec(0), commands(0) { }
+};
+
+// Print statistics of one check cycle, return true if last cycle is done
+static bool benchmark_cycle_done(benchmark_stats & bs, unsigned numdevs,
+  long long cycle_usec, const sim_device_stats & before)
+{
+  const sim_device_stats & after = get_sim_device_stats();
+  uint64_t commands = after.commands - before.commands;
+  bs.cycles++;
+  if (bs.cycles == 1 || cycle_usec < bs.min_usec)
+    bs.min_usec = cycle_usec;
+  if (cycle_usec > bs.max_usec)
+    bs.max_usec = cycle_usec;
+  bs.sum_usec += cycle_usec;
+  bs.commands += commands;
+
+  PrintOut(LOG_INFO, "Benchmark cycle %d/%d: %u devices, %.3f seconds, "
+           "%" PRIu64 " commands (%" PRIu64 " failed, %" PRIu64 " hung), max RSS %ld KiB\n",
+           bs.cycles, quit_benchmark_cycles, numdevs, cycle_usec / 1000000.0, commands,
+           after.failures - before.failures, after.hangs - before.hangs, get_max_rss_kib());
+  if (bs.cycles < quit_benchmark_cycles)
+    return false;
+
+  PrintOut(LOG_INFO, "Benchmark result: %d cycles, %u devices, cycle time "
+           "min/avg/max %.3f/%.3f/%.3f seconds, %.2f commands per device and cycle, "
+           "max RSS %ld KiB\n",
+           bs.cycles, numdevs, bs.min_usec / 1000000.0,
+           bs.sum_usec / 1000000.0 / bs.cycles, bs.max_usec / 1000000.0,
+           (numdevs ? (double)bs.commands / numdevs / bs.cycles : 0.0), get_max_rss_kib());
+  return true;
+}
+
+
 // Main program without exception handling
 static int main_worker(int argc, char **argv)
 {
@@ -5773,6 +7338,8 @@ static int main_worker(int argc, char **argv)
   // the main loop of the code
   bool firstpass = true, write_states_always = true;
   time_t wakeuptime = 0;
+  benchmark_stats bench_stats;
+  long long start_usec = get_timer_usec();
   // assert(status < 0);
   do {
     // Should we (re)read the config file?
@@ -5838,6 +7405,18 @@ static int main_worker(int argc, char **argv)
       PrintOut(LOG_INFO, "Monitoring %d ATA/SATA, %d SCSI/SAS and %d NVMe devices\n",
                numata, numscsi, (int)devices.size() - numata - numscsi);
 
+      if (debugmode) {
+        // Report memory footprint of device state
+        size_t total = 0;
+        for (unsigned i = 0; i < states.size(); i++) {
+          size_t size = states[i].mem_size();
+          PrintOut(LOG_INFO, "Device: %s, state uses %u bytes, config %u bytes\n",
+                   configs[i].name.c_str(), (unsigned)size, (unsigned)sizeof(dev_config));
+          total += size + sizeof(dev_config);
+        }
+        PrintOut(LOG_INFO, "Device state and config use %u bytes\n", (unsigned)total);
+      }
+
       if (quit == QUIT_SHOWTESTS) {
         // user has asked to print test schedule
         PrintTestSchedule(configs, states, devices);
@@ -5855,7 +7434,14 @@ static int main_worker(int argc, char **argv)
     // check all devices once,
     // self tests are not started in first pass unless '-q onecheck' is specified
     notify_check((int)devices.size());
+    long long cycle_start_usec = get_timer_usec();
+    sim_device_stats sim_stats_before = get_sim_device_stats();
+    if (quit == QUIT_BENCHMARK && firstpass)
+      PrintOut(LOG_INFO, "Benchmark setup: %u devices registered in %.3f seconds, "
+               "max RSS %ld KiB\n", (unsigned)devices.size(),
+               (cycle_start_usec - start_usec) / 1000000.0, get_max_rss_kib());
     CheckDevicesOnce(configs, states, devices, firstpass, (!firstpass || quit == QUIT_ONECHECK));
+    long long cycle_usec = get_timer_usec() - cycle_start_usec;
 
      // Write state files
     if (!state_path_prefix.empty())
@@ -5866,6 +7452,15 @@ static int main_worker(int argc, char **argv)
     if (!attrlog_path_prefix.empty())
       write_all_dev_attrlogs(configs, states);
 
+    // user has asked us to run N check cycles without waiting
+    if (quit == QUIT_BENCHMARK) {
+      if (benchmark_cycle_done(bench_stats, (unsigned)devices.size(), cycle_usec,
+                               sim_stats_before))
+        return 0;
+      firstpass = false;
+      continue;
+    }
+
     // user has asked us to exit after first check
     if (quit == QUIT_ONECHECK) {
       PrintOut(LOG_INFO,"Started with '-q onecheck' option. All devices successfully checked once.\n"